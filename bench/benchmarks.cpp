@@ -0,0 +1,500 @@
+#include "gpu.hpp"
+#include "cpu.hpp"
+#include "gemm.hpp"
+#include "gpu_stream.hpp"
+#include "types.hpp"
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Sweeps transfer sizes and dispatch batch depths, times shader compilation and measures
+// elementwise, GEMM and streaming throughput, writing the results as JSON to the path given as
+// the first argument, or stdout. Exits with failure if any GEMM result disagrees with the CPU
+// backend. Run from the build directory so the shaders are found.
+
+template<typename F>
+double measureMicroseconds(size_t iterations, F&& fn) {
+  auto startTime = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    fn();
+  }
+  auto endTime = std::chrono::high_resolution_clock::now();
+  auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count();
+
+  return time / 1000.0 / iterations;
+}
+
+// Bytes per microsecond is MB/s
+double gigabytesPerSecond(size_t bytes, double microseconds) {
+  return bytes / microseconds / 1000.0;
+}
+
+// Compiles a shader not seen before against an empty cache, then again once cached
+std::string benchmarkCompileTime(Gpu& gpu) {
+  constexpr size_t warmIterations = 10;
+
+  auto compile = [&]() {
+    ShaderHandle shader = gpu.compileShader("shaders/bench_increment.glsl", {}, { 64, 1, 1 });
+    gpu.destroyShader(shader);
+  };
+
+  double coldTime = measureMicroseconds(1, compile);
+  double warmTime = measureMicroseconds(warmIterations, compile);
+
+  std::stringstream json;
+  json << "{ \"cold_ms\": " << coldTime / 1000.0 << ", \"warm_ms\": " << warmTime / 1000.0
+    << " }";
+
+  return json.str();
+}
+
+std::string benchmarkTransfers(Gpu& gpu) {
+  const std::vector<size_t> sizes{
+    4 * 1024,
+    64 * 1024,
+    1024 * 1024,
+    16 * 1024 * 1024,
+    64 * 1024 * 1024
+  };
+  // Enough iterations to move this many bytes per size, so small sizes aren't all noise
+  constexpr size_t bytesPerSize = 256 * 1024 * 1024;
+  constexpr size_t maxIterations = 1000;
+
+  std::stringstream json;
+  json << "[";
+
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    size_t size = sizes[i];
+    size_t iterations = std::max<size_t>(3, std::min(maxIterations, bytesPerSize / size));
+
+    std::cerr << "Transfers of " << size << " bytes" << std::endl;
+
+    std::vector<netfloat_t> data(size / sizeof(netfloat_t), 1.f);
+
+    GpuBuffer buffer = gpu.allocateBuffer(size,
+      GpuBufferFlags::large | GpuBufferFlags::hostReadAccess | GpuBufferFlags::hostWriteAccess);
+
+    // Uploads are only queued, so flush to include the copy itself
+    auto upload = [&]() {
+      gpu.submitBufferData(buffer.handle, data.data());
+      gpu.flushQueue();
+    };
+    auto download = [&]() { gpu.retrieveBuffer(buffer.handle, data.data()); };
+
+    upload();
+    double uploadTime = measureMicroseconds(iterations, upload);
+
+    download();
+    double downloadTime = measureMicroseconds(iterations, download);
+
+    gpu.freeBuffer(buffer.handle);
+
+    json << (i > 0 ? ", " : "") << "{ \"bytes\": " << size
+      << ", \"upload_us\": " << uploadTime
+      << ", \"upload_gbps\": " << gigabytesPerSecond(size, uploadTime)
+      << ", \"download_us\": " << downloadTime
+      << ", \"download_gbps\": " << gigabytesPerSecond(size, downloadTime) << " }";
+  }
+
+  json << "]";
+  return json.str();
+}
+
+// Latency per dispatch of batches of depth dispatches, each batch queued then flushed. Empty
+// dispatches are independent, whereas chained ones each depend on the one before.
+std::string benchmarkDispatches(Gpu& gpu) {
+  const std::vector<size_t> depths{ 1, 4, 16, 64, 256 };
+  constexpr size_t dispatchesPerDepth = 4096;
+  constexpr uint32_t chainedElements = 64 * 1024;
+
+  GpuBuffer buffer = gpu.allocateBuffer(chainedElements * sizeof(netfloat_t),
+    GpuBufferFlags::large);
+
+  std::vector<ShaderHandle> shaders = gpu.compileShaders({
+    { "shaders/bench_empty.glsl", {}, { 64, 1, 1 } },
+    { "shaders/bench_increment.glsl", { buffer.handle }, { 64, 1, 1 } }
+  });
+
+  ShaderHandle emptyShader = shaders[0];
+  ShaderHandle chainedShader = shaders[1];
+
+  std::stringstream json;
+  json << "[";
+
+  for (size_t i = 0; i < depths.size(); ++i) {
+    size_t depth = depths[i];
+    size_t batches = std::max<size_t>(1, dispatchesPerDepth / depth);
+
+    std::cerr << "Dispatch batches of depth " << depth << std::endl;
+
+    auto runBatch = [&](ShaderHandle shader, uint32_t problemSize) {
+      for (size_t j = 0; j < depth; ++j) {
+        gpu.queueShader(shader, { problemSize, 1, 1 });
+      }
+      gpu.flushQueue();
+    };
+
+    auto empty = [&]() { runBatch(emptyShader, 1); };
+    auto chained = [&]() { runBatch(chainedShader, chainedElements); };
+
+    empty();
+    double emptyTime = measureMicroseconds(batches, empty) / depth;
+
+    chained();
+    double chainedTime = measureMicroseconds(batches, chained) / depth;
+
+    json << (i > 0 ? ", " : "") << "{ \"depth\": " << depth
+      << ", \"empty_us\": " << emptyTime
+      << ", \"chained_us\": " << chainedTime << " }";
+  }
+
+  json << "]";
+
+  gpu.destroyShader(emptyShader);
+  gpu.destroyShader(chainedShader);
+  gpu.freeBuffer(buffer.handle);
+
+  return json.str();
+}
+
+// Throughput of the elementwise example shaders, which process four elements per invocation,
+// against shader2.glsl in the scalar std430 layout and the earlier std140 component indexing
+std::string benchmarkElementwise(Gpu& gpu) {
+  constexpr uint32_t elements = 16 * 1024 * 1024;
+  constexpr size_t bytes = elements * sizeof(netfloat_t) * 2;
+  constexpr size_t iterations = 20;
+
+  std::cerr << "Elementwise shaders" << std::endl;
+
+  GpuBuffer inputBuffer = gpu.allocateBuffer(elements * sizeof(netfloat_t),
+    GpuBufferFlags::large | GpuBufferFlags::hostWriteAccess);
+  GpuBuffer outputBuffer = gpu.allocateBuffer(elements * sizeof(netfloat_t),
+    GpuBufferFlags::large);
+
+  std::vector<netfloat_t> input(elements, 1.f);
+  gpu.submitBufferData(inputBuffer.handle, input.data());
+
+  struct Variant {
+    std::string name;
+    ShaderDesc desc;
+  };
+
+  std::vector<Variant> variants{
+    { "shader", { "shaders/shader.glsl", {}, { 64, 1, 1 }, { 4, 1, 1 } } },
+    { "shader2", { "shaders/shader2.glsl", {}, { 64, 1, 1 }, { 4, 1, 1 } } },
+    { "shader2_scalar", { "shaders/bench_scale_scalar.glsl", {}, { 64, 1, 1 } } }
+  };
+
+#if !defined(NETFLOAT_FP16) && !defined(NETFLOAT_BF16)
+  variants.push_back({ "shader2_std140", { "shaders/bench_scale_std140.glsl", {}, { 64, 1, 1 } } });
+#endif
+
+  // Read by shader.glsl and ignored by the others
+  const float params[4]{ 1.f, 2.f, 3.f, 4.f };
+
+  std::stringstream json;
+  json << "{ \"bytes\": " << bytes;
+
+  for (const Variant& variant : variants) {
+    ShaderHandle shader = gpu.compileShaders({ variant.desc })[0];
+    bool hasParams = variant.name == "shader";
+
+    auto run = [&]() {
+      for (size_t i = 0; i < iterations; ++i) {
+        gpu.queueShaderWithBindings(shader, { inputBuffer.handle, outputBuffer.handle },
+          { elements, 1, 1 }, hasParams ? params : nullptr, hasParams ? sizeof(params) : 0);
+      }
+      gpu.flushQueue();
+    };
+
+    run();
+    double time = measureMicroseconds(1, run) / iterations;
+
+    json << ", \"" << variant.name << "_gbps\": " << gigabytesPerSecond(bytes, time);
+
+    gpu.destroyShader(shader);
+  }
+
+  json << " }";
+
+  gpu.freeBuffer(inputBuffer.handle);
+  gpu.freeBuffer(outputBuffer.handle);
+
+  return json.str();
+}
+
+struct GemmProblem {
+  uint32_t M;
+  uint32_t N;
+  uint32_t K;
+  bool transposeA;
+  bool transposeB;
+};
+
+// C = op(A) op(B) on the given backend
+std::vector<netfloat_t> multiply(Gpu& gpu, const GemmProblem& problem,
+  const std::vector<netfloat_t>& A, const std::vector<netfloat_t>& B) {
+
+  GpuBuffer bufferA = gpu.allocateBuffer(A.size() * sizeof(netfloat_t),
+    GpuBufferFlags::large | GpuBufferFlags::hostWriteAccess);
+  GpuBuffer bufferB = gpu.allocateBuffer(B.size() * sizeof(netfloat_t),
+    GpuBufferFlags::large | GpuBufferFlags::hostWriteAccess);
+  GpuBuffer bufferC = gpu.allocateBuffer(problem.M * problem.N * sizeof(netfloat_t),
+    GpuBufferFlags::large | GpuBufferFlags::hostReadAccess);
+
+  gpu.submitBufferData(bufferA.handle, A.data());
+  gpu.submitBufferData(bufferB.handle, B.data());
+
+  Gemm gemm(gpu);
+  gemm.queue(bufferA.handle, bufferB.handle, bufferC.handle, problem.M, problem.N, problem.K,
+    problem.transposeA, problem.transposeB);
+
+  std::vector<netfloat_t> C(problem.M * problem.N);
+  gpu.retrieveBuffer(bufferC.handle, C.data());
+
+  gpu.freeBuffer(bufferA.handle);
+  gpu.freeBuffer(bufferB.handle);
+  gpu.freeBuffer(bufferC.handle);
+
+  return C;
+}
+
+// Allows for the summation order differing from the CPU's and for rounding of the output
+bool resultsMatch(const std::vector<netfloat_t>& actual, const std::vector<netfloat_t>& expected) {
+#if defined(NETFLOAT_FP16)
+  const float tolerance = 2e-3f;
+#elif defined(NETFLOAT_BF16)
+  const float tolerance = 1e-2f;
+#else
+  const float tolerance = 1e-4f;
+#endif
+
+  for (size_t i = 0; i < actual.size(); ++i) {
+    if (!(std::abs(actual[i] - expected[i]) <= tolerance * (1.f + std::abs(expected[i])))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// GFLOP/s of each tile configuration on square and ragged problems, in every combination of
+// transposes, after checking its output against the CPU backend
+std::string benchmarkGemm(Gpu& gpu, bool& valid) {
+  const std::vector<GemmConfig> configs{
+    { 32, 32, 16, 2, 2 },
+    { 64, 64, 16, 4, 4 },
+    { 64, 64, 16, 8, 8 },
+    { 128, 128, 8, 8, 8 }
+  };
+
+  const std::vector<GemmProblem> problems{
+    { 1024, 1024, 1024, false, false },
+    { 1000, 999, 1001, true, false },
+    { 513, 257, 129, false, true },
+    { 255, 383, 511, true, true }
+  };
+
+  constexpr size_t iterations = 5;
+
+  GpuPtr cpu = createCpuGpu();
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+
+  std::stringstream json;
+  json << "[";
+
+  for (size_t i = 0; i < problems.size(); ++i) {
+    const GemmProblem& problem = problems[i];
+
+    std::vector<netfloat_t> A(problem.M * problem.K);
+    std::vector<netfloat_t> B(problem.K * problem.N);
+    for (netfloat_t& x : A) {
+      x = distribution(random);
+    }
+    for (netfloat_t& x : B) {
+      x = distribution(random);
+    }
+
+    std::vector<netfloat_t> expected = multiply(*cpu, problem, A, B);
+
+    GpuBuffer bufferA = gpu.allocateBuffer(A.size() * sizeof(netfloat_t),
+      GpuBufferFlags::large | GpuBufferFlags::hostWriteAccess);
+    GpuBuffer bufferB = gpu.allocateBuffer(B.size() * sizeof(netfloat_t),
+      GpuBufferFlags::large | GpuBufferFlags::hostWriteAccess);
+    GpuBuffer bufferC = gpu.allocateBuffer(expected.size() * sizeof(netfloat_t),
+      GpuBufferFlags::large | GpuBufferFlags::hostReadAccess);
+
+    gpu.submitBufferData(bufferA.handle, A.data());
+    gpu.submitBufferData(bufferB.handle, B.data());
+
+    for (size_t j = 0; j < configs.size(); ++j) {
+      const GemmConfig& config = configs[j];
+
+      std::cerr << "GEMM " << problem.M << "x" << problem.N << "x" << problem.K << " with "
+        << config.tileM << "x" << config.tileN << "x" << config.tileK << " tiles" << std::endl;
+
+      Gemm gemm(gpu, config);
+      gemm.queue(bufferA.handle, bufferB.handle, bufferC.handle, problem.M, problem.N, problem.K,
+        problem.transposeA, problem.transposeB);
+
+      std::vector<netfloat_t> C(expected.size());
+      gpu.retrieveBuffer(bufferC.handle, C.data());
+
+      bool correct = resultsMatch(C, expected);
+      valid = valid && correct;
+
+      auto run = [&]() {
+        for (size_t k = 0; k < iterations; ++k) {
+          gemm.queue(bufferA.handle, bufferB.handle, bufferC.handle, problem.M, problem.N,
+            problem.K, problem.transposeA, problem.transposeB);
+        }
+        gpu.flushQueue();
+      };
+
+      double time = measureMicroseconds(1, run) / iterations;
+      double flops = 2.0 * problem.M * problem.N * problem.K;
+
+      json << ((i > 0 || j > 0) ? ", " : "") << "{ \"m\": " << problem.M
+        << ", \"n\": " << problem.N
+        << ", \"k\": " << problem.K
+        << ", \"transpose_a\": " << (problem.transposeA ? "true" : "false")
+        << ", \"transpose_b\": " << (problem.transposeB ? "true" : "false")
+        << ", \"tile\": [" << config.tileM << ", " << config.tileN << ", " << config.tileK << "]"
+        << ", \"thread\": [" << config.threadM << ", " << config.threadN << "]"
+        << ", \"valid\": " << (correct ? "true" : "false")
+        << ", \"gflops\": " << flops / time / 1000.0 << " }";
+    }
+
+    gpu.freeBuffer(bufferA.handle);
+    gpu.freeBuffer(bufferB.handle);
+    gpu.freeBuffer(bufferC.handle);
+  }
+
+  json << "]";
+  return json.str();
+}
+
+// Sustained throughput of a GpuStream compared with submitting, running and retrieving each chunk
+// in turn
+std::string benchmarkStreaming(Gpu& gpu) {
+  constexpr size_t elements = 16 * 1024 * 1024;
+  constexpr size_t chunkElements = 1024 * 1024;
+  constexpr size_t bytes = elements * sizeof(netfloat_t) * 2;
+
+  std::cerr << "Streaming" << std::endl;
+
+  std::vector<netfloat_t> input(elements, 1.f);
+  std::vector<netfloat_t> output(elements);
+
+  ShaderHandle shader = gpu.compileShaders({
+    { "shaders/shader2.glsl", {}, { 64, 1, 1 }, { 4, 1, 1 } }
+  })[0];
+
+  GpuBuffer inputBuffer = gpu.allocateBuffer(chunkElements * sizeof(netfloat_t),
+    GpuBufferFlags::large | GpuBufferFlags::hostWriteAccess);
+  GpuBuffer outputBuffer = gpu.allocateBuffer(chunkElements * sizeof(netfloat_t),
+    GpuBufferFlags::large | GpuBufferFlags::hostReadAccess);
+
+  auto sequential = [&]() {
+    for (size_t first = 0; first < elements; first += chunkElements) {
+      gpu.submitBufferData(inputBuffer.handle, input.data() + first);
+      gpu.queueShaderWithBindings(shader, { inputBuffer.handle, outputBuffer.handle },
+        { chunkElements, 1, 1 });
+      gpu.retrieveBuffer(outputBuffer.handle, output.data() + first);
+    }
+  };
+
+  sequential();
+  double sequentialTime = measureMicroseconds(3, sequential);
+
+  gpu.freeBuffer(inputBuffer.handle);
+  gpu.freeBuffer(outputBuffer.handle);
+
+  std::stringstream json;
+  json << "{ \"bytes\": " << bytes
+    << ", \"sequential_gbps\": " << gigabytesPerSecond(bytes, sequentialTime);
+
+  for (size_t depth : { 2, 3 }) {
+    GpuStreamDesc desc;
+    desc.shader = shader;
+    desc.chunkElements = chunkElements;
+    desc.depth = depth;
+
+    GpuStream stream(gpu, desc);
+
+    auto streamed = [&]() { stream.process(input.data(), output.data(), elements); };
+
+    streamed();
+    double streamedTime = measureMicroseconds(3, streamed);
+
+    json << ", \"depth_" << depth << "_gbps\": " << gigabytesPerSecond(bytes, streamedTime);
+  }
+
+  json << " }";
+
+  gpu.destroyShader(shader);
+
+  return json.str();
+}
+
+int main(int argc, char** argv) {
+  // Compile times are only meaningful against an empty cache
+  auto cachePath = std::filesystem::temp_directory_path() /
+    ("vulkan_compute_benchmarks_" + std::to_string(std::chrono::steady_clock::now()
+      .time_since_epoch().count()));
+
+  std::filesystem::create_directories(cachePath);
+  setenv("VULKAN_COMPUTE_CACHE_DIR", cachePath.c_str(), 1);
+
+  std::stringstream json;
+  bool gemmValid = true;
+
+  {
+    GpuPtr gpu = createGpu();
+
+    std::cerr << "Compile time" << std::endl;
+    std::string compile = benchmarkCompileTime(*gpu);
+    std::string transfers = benchmarkTransfers(*gpu);
+    std::string dispatches = benchmarkDispatches(*gpu);
+    std::string elementwise = benchmarkElementwise(*gpu);
+    std::string gemm = benchmarkGemm(*gpu, gemmValid);
+    std::string streaming = benchmarkStreaming(*gpu);
+
+    json << "{" << std::endl
+      << "  \"compile\": " << compile << "," << std::endl
+      << "  \"transfers\": " << transfers << "," << std::endl
+      << "  \"dispatches\": " << dispatches << "," << std::endl
+      << "  \"elementwise\": " << elementwise << "," << std::endl
+      << "  \"gemm\": " << gemm << "," << std::endl
+      << "  \"streaming\": " << streaming << std::endl
+      << "}" << std::endl;
+  }
+
+  std::filesystem::remove_all(cachePath);
+
+  if (argc > 1) {
+    std::ofstream stream(argv[1]);
+    stream << json.str();
+    if (!stream.good()) {
+      std::cerr << "Failed to write " << argv[1] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  else {
+    std::cout << json.str();
+  }
+
+  if (!gemmValid) {
+    std::cerr << "GEMM results don't match the CPU backend" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
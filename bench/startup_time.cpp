@@ -0,0 +1,47 @@
+#include "gpu.hpp"
+#include <cstdlib>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+// Measures the time to create a Gpu and compile the example shaders, first against an empty
+// cache directory (cold) and then again with the caches populated (warm).
+
+double measureStartupMilliseconds() {
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  GpuPtr gpu = createGpu();
+
+  GpuBuffer bufferA = gpu->allocateBuffer(1024, GpuBufferFlags::large);
+  GpuBuffer bufferB = gpu->allocateBuffer(1024, GpuBufferFlags::large);
+
+  gpu->compileShaders({
+    { "shaders/shader.glsl", { bufferA.handle, bufferB.handle }, { 64, 1, 1 } },
+    { "shaders/shader2.glsl", { bufferB.handle, bufferA.handle }, { 64, 1, 1 } }
+  });
+
+  auto endTime = std::chrono::high_resolution_clock::now();
+  auto time = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
+
+  return time / 1000.0;
+}
+
+int main() {
+  auto cachePath = std::filesystem::temp_directory_path() /
+    ("vulkan_compute_startup_" + std::to_string(std::chrono::steady_clock::now()
+      .time_since_epoch().count()));
+
+  std::filesystem::create_directories(cachePath);
+  setenv("VULKAN_COMPUTE_CACHE_DIR", cachePath.c_str(), 1);
+
+  double coldTime = measureStartupMilliseconds();
+  double warmTime = measureStartupMilliseconds();
+
+  std::cout << "cold start (ms), warm start (ms)" << std::endl;
+  std::cout << coldTime << ", " << warmTime << std::endl;
+
+  std::filesystem::remove_all(cachePath);
+
+  return EXIT_SUCCESS;
+}
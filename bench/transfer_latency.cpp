@@ -0,0 +1,60 @@
+#include "gpu.hpp"
+#include "types.hpp"
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// Measures the mean host-side latency of a single submitBufferData / retrieveBuffer call across a
+// range of transfer sizes, along with reading back just the last element of each buffer.
+
+template<typename F>
+double measureMicroseconds(size_t iterations, F&& fn) {
+  auto startTime = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    fn();
+  }
+  auto endTime = std::chrono::high_resolution_clock::now();
+  auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count();
+
+  return time / 1000.0 / iterations;
+}
+
+int main() {
+  GpuPtr gpu = createGpu();
+
+  const std::vector<size_t> sizes{ 64, 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024 };
+  constexpr size_t warmupIterations = 10;
+  constexpr size_t iterations = 1000;
+
+  std::cout << "bytes, upload (us/call), download (us/call), last element download (us/call)"
+    << std::endl;
+
+  for (size_t size : sizes) {
+    std::vector<netfloat_t> data(size / sizeof(netfloat_t), 1.f);
+
+    GpuBuffer buffer = gpu->allocateBuffer(size,
+      GpuBufferFlags::large | GpuBufferFlags::hostReadAccess | GpuBufferFlags::hostWriteAccess);
+
+    auto upload = [&]() { gpu->submitBufferData(buffer.handle, data.data()); };
+    auto download = [&]() { gpu->retrieveBuffer(buffer.handle, data.data()); };
+    auto downloadLast = [&]() {
+      gpu->retrieveBuffer(buffer.handle, &data.back(), size - sizeof(netfloat_t),
+        sizeof(netfloat_t));
+    };
+
+    measureMicroseconds(warmupIterations, upload);
+    double uploadTime = measureMicroseconds(iterations, upload);
+
+    measureMicroseconds(warmupIterations, download);
+    double downloadTime = measureMicroseconds(iterations, download);
+
+    measureMicroseconds(warmupIterations, downloadLast);
+    double downloadLastTime = measureMicroseconds(iterations, downloadLast);
+
+    std::cout << size << ", " << uploadTime << ", " << downloadTime << ", " << downloadLastTime
+      << std::endl;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,6 @@
+#version 450
+
+#include "utils.glsl"
+
+void main() {
+}
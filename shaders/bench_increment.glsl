@@ -0,0 +1,19 @@
+#version 450
+
+#include "utils.glsl"
+
+layout(std430, binding = 0) buffer DataSsbo {
+  NETFLOAT_PACK Data[];
+};
+
+FN_READ(Data)
+FN_WRITE(Data)
+FN_SIZE(Data)
+
+void main() {
+  const uint index = gl_GlobalInvocationID.x;
+  if (index >= sizeData()) {
+    return;
+  }
+  writeData(index, readData(index) + 1.0);
+}
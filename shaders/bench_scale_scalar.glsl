@@ -0,0 +1,26 @@
+#version 450
+
+#include "utils.glsl"
+
+// shader2.glsl with one element per invocation
+
+layout(std430, binding = 0) readonly buffer BSsbo {
+  NETFLOAT_PACK B[];
+};
+
+FN_READ(B)
+
+layout(std430, binding = 1) NETFLOAT_WRITEONLY buffer ASsbo {
+  NETFLOAT_PACK A[];
+};
+
+FN_WRITE(A)
+FN_SIZE(A)
+
+void main() {
+  const uint index = gl_GlobalInvocationID.x;
+  if (index >= sizeA()) {
+    return;
+  }
+  writeA(index, readB(index) * 3.0);
+}
@@ -0,0 +1,22 @@
+#version 450
+
+#include "utils.glsl"
+
+// shader2.glsl as it was before the std430 layouts, indexing components of std140 vec4 arrays
+// one element per invocation. Only valid for float netfloat_t.
+
+layout(std140, binding = 0) readonly buffer BSsbo {
+  vec4 B[];
+};
+
+layout(std140, binding = 1) writeonly buffer ASsbo {
+  vec4 A[];
+};
+
+void main() {
+  const uint index = gl_GlobalInvocationID.x;
+  if (index >= A.length() * 4) {
+    return;
+  }
+  A[index / 4][index % 4] = B[index / 4][index % 4] * 3.0;
+}
@@ -0,0 +1,131 @@
+#version 450
+
+#include "utils.glsl"
+
+// C = alpha op(A) op(B) + beta C for row-major matrices, where op(A) is M x K and op(B) is K x N.
+// Each workgroup computes a TILE_M x TILE_N tile of C, staging TILE_K wide slices of A and B
+// through shared memory. Each invocation accumulates a block of outputs in registers, spaced
+// local_size apart so that neighbouring invocations access neighbouring columns. The workgroup
+// size must divide the tile: it's local_size_y rows by local_size_x columns.
+
+layout(constant_id = 3) const uint TILE_M = 64;
+layout(constant_id = 4) const uint TILE_N = 64;
+layout(constant_id = 5) const uint TILE_K = 16;
+
+const uint THREAD_M = TILE_M / local_size_y;
+const uint THREAD_N = TILE_N / local_size_x;
+
+layout(push_constant) uniform PushConstants {
+  uint M;
+  uint N;
+  uint K;
+  uint transposeA;
+  uint transposeB;
+  float alpha;
+  float beta;
+} constants;
+
+layout(std430, binding = 0) readonly buffer ASsbo {
+  NETFLOAT_PACK A[];
+};
+
+FN_READ(A)
+
+layout(std430, binding = 1) readonly buffer BSsbo {
+  NETFLOAT_PACK B[];
+};
+
+FN_READ(B)
+
+layout(std430, binding = 2) buffer CSsbo {
+  NETFLOAT_PACK C[];
+};
+
+FN_READ(C)
+FN_WRITE(C)
+
+// Both transposed so that the inner loop reads along rows
+shared float tileA[TILE_K * TILE_M];
+shared float tileB[TILE_K * TILE_N];
+
+// op(A)[m][k], or 0 outside the matrix
+float loadA(uint m, uint k) {
+  if (m >= constants.M || k >= constants.K) {
+    return 0.0;
+  }
+  return constants.transposeA != 0 ? readA(k * constants.M + m) : readA(m * constants.K + k);
+}
+
+// op(B)[k][n], or 0 outside the matrix
+float loadB(uint k, uint n) {
+  if (k >= constants.K || n >= constants.N) {
+    return 0.0;
+  }
+  return constants.transposeB != 0 ? readB(n * constants.K + k) : readB(k * constants.N + n);
+}
+
+void main() {
+  const uint threads = local_size_x * local_size_y;
+  const uint thread = gl_LocalInvocationIndex;
+  const uint row0 = gl_WorkGroupID.y * TILE_M;
+  const uint col0 = gl_WorkGroupID.x * TILE_N;
+
+  float acc[THREAD_M * THREAD_N];
+  for (uint i = 0; i < THREAD_M * THREAD_N; ++i) {
+    acc[i] = 0.0;
+  }
+
+  float a[THREAD_M];
+  float b[THREAD_N];
+
+  for (uint k0 = 0; k0 < constants.K; k0 += TILE_K) {
+    // Consecutive invocations load consecutive addresses of whichever layout A and B are in
+    for (uint i = thread; i < TILE_M * TILE_K; i += threads) {
+      uint m = constants.transposeA != 0 ? i % TILE_M : i / TILE_K;
+      uint k = constants.transposeA != 0 ? i / TILE_M : i % TILE_K;
+      tileA[k * TILE_M + m] = loadA(row0 + m, k0 + k);
+    }
+    for (uint i = thread; i < TILE_N * TILE_K; i += threads) {
+      uint n = constants.transposeB != 0 ? i / TILE_K : i % TILE_N;
+      uint k = constants.transposeB != 0 ? i % TILE_K : i / TILE_N;
+      tileB[k * TILE_N + n] = loadB(k0 + k, col0 + n);
+    }
+
+    barrier();
+
+    for (uint k = 0; k < TILE_K; ++k) {
+      for (uint i = 0; i < THREAD_M; ++i) {
+        a[i] = tileA[k * TILE_M + gl_LocalInvocationID.y + i * local_size_y];
+      }
+      for (uint j = 0; j < THREAD_N; ++j) {
+        b[j] = tileB[k * TILE_N + gl_LocalInvocationID.x + j * local_size_x];
+      }
+      for (uint i = 0; i < THREAD_M; ++i) {
+        for (uint j = 0; j < THREAD_N; ++j) {
+          acc[i * THREAD_N + j] = fma(a[i], b[j], acc[i * THREAD_N + j]);
+        }
+      }
+    }
+
+    barrier();
+  }
+
+  for (uint i = 0; i < THREAD_M; ++i) {
+    uint m = row0 + gl_LocalInvocationID.y + i * local_size_y;
+    if (m >= constants.M) {
+      break;
+    }
+    for (uint j = 0; j < THREAD_N; ++j) {
+      uint n = col0 + gl_LocalInvocationID.x + j * local_size_x;
+      if (n >= constants.N) {
+        break;
+      }
+      uint index = m * constants.N + n;
+      float value = constants.alpha * acc[i * THREAD_N + j];
+      if (constants.beta != 0.0) {
+        value += constants.beta * readC(index);
+      }
+      writeC(index, value);
+    }
+  }
+}
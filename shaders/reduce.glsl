@@ -0,0 +1,36 @@
+#version 450
+
+#include "utils.glsl"
+#include "reduction.glsl"
+
+// First pass of a reduction, combining each block of the first constants.count elements of Input
+// into a Partial
+
+layout(std430, binding = 0) readonly buffer InputSsbo {
+  NETFLOAT_PACK Input[];
+};
+
+FN_READ(Input)
+
+layout(std430, binding = 1) writeonly buffer OutputSsbo {
+  Partial Output[];
+};
+
+void main() {
+  const uint first = gl_WorkGroupID.x * ITEMS * local_size_x + gl_LocalInvocationID.x;
+
+  // Strided by the workgroup size so that neighbouring invocations read neighbouring elements
+  Partial value = identity();
+  for (uint i = 0; i < ITEMS; ++i) {
+    uint index = first + i * local_size_x;
+    if (index < constants.count) {
+      value = combine(value, Partial(readInput(index), index));
+    }
+  }
+
+  value = workgroupReduce(value);
+
+  if (gl_LocalInvocationID.x == 0) {
+    Output[gl_WorkGroupID.x] = value;
+  }
+}
@@ -0,0 +1,32 @@
+#version 450
+
+#include "utils.glsl"
+#include "reduction.glsl"
+
+// Later passes of a reduction, combining each block of the partial results of the pass before
+
+layout(std430, binding = 0) readonly buffer InputSsbo {
+  Partial Input[];
+};
+
+layout(std430, binding = 1) writeonly buffer OutputSsbo {
+  Partial Output[];
+};
+
+void main() {
+  const uint first = gl_WorkGroupID.x * ITEMS * local_size_x + gl_LocalInvocationID.x;
+
+  Partial value = identity();
+  for (uint i = 0; i < ITEMS; ++i) {
+    uint index = first + i * local_size_x;
+    if (index < constants.count) {
+      value = combine(value, Input[index]);
+    }
+  }
+
+  value = workgroupReduce(value);
+
+  if (gl_LocalInvocationID.x == 0) {
+    Output[gl_WorkGroupID.x] = value;
+  }
+}
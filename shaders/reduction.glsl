@@ -0,0 +1,168 @@
+// Workgroup-wide reductions and scans, shared by reduce*.glsl and scan*.glsl. Include after
+// utils.glsl. Subgroup arithmetic does most of the work where the device supports it, leaving
+// only the per-subgroup results to combine through shared memory.
+//
+// Each workgroup handles a block of ITEMS * local_size_x elements, so the host dispatches with
+// ShaderDesc::elementsPerInvocation of ITEMS.
+
+#if defined(SUBGROUP_ARITHMETIC)
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+#endif
+
+layout(constant_id = 3) const uint ITEMS = 16;
+
+#define REDUCE_SUM 0
+#define REDUCE_MIN 1
+#define REDUCE_MAX 2
+#define REDUCE_ARGMAX 3
+
+// Matches ReductionResult. index is only meaningful for REDUCE_ARGMAX.
+struct Partial {
+  float value;
+  uint index;
+};
+
+layout(push_constant) uniform PushConstants {
+  uint count;
+  uint op;
+  uint exclusive;
+} constants;
+
+Partial identity() {
+  switch (constants.op) {
+    case REDUCE_MIN:
+      return Partial(uintBitsToFloat(0x7f800000u), 0);
+    case REDUCE_MAX:
+    case REDUCE_ARGMAX:
+      return Partial(uintBitsToFloat(0xff800000u), 0xffffffffu);
+    default:
+      return Partial(0.0, 0);
+  }
+}
+
+// Ties in argmax go to the lower index
+Partial combine(Partial a, Partial b) {
+  switch (constants.op) {
+    case REDUCE_MIN:
+      return Partial(min(a.value, b.value), 0);
+    case REDUCE_MAX:
+      return Partial(max(a.value, b.value), 0);
+    case REDUCE_ARGMAX:
+      return b.value > a.value || (b.value == a.value && b.index < a.index) ? b : a;
+    default:
+      return Partial(a.value + b.value, 0);
+  }
+}
+
+#if defined(SUBGROUP_ARITHMETIC)
+Partial subgroupCombine(Partial value) {
+  switch (constants.op) {
+    case REDUCE_MIN:
+      return Partial(subgroupMin(value.value), 0);
+    case REDUCE_MAX:
+      return Partial(subgroupMax(value.value), 0);
+    case REDUCE_ARGMAX: {
+      float best = subgroupMax(value.value);
+      return Partial(best, subgroupMin(value.value == best ? value.index : 0xffffffffu));
+    }
+    default:
+      return Partial(subgroupAdd(value.value), 0);
+  }
+}
+#endif
+
+shared Partial sharedPartials[local_size_x];
+
+// The combination of every invocation's value, returned to all of them
+Partial workgroupReduce(Partial value) {
+  const uint thread = gl_LocalInvocationID.x;
+
+#if defined(SUBGROUP_ARITHMETIC)
+  value = subgroupCombine(value);
+  if (subgroupElect()) {
+    sharedPartials[gl_SubgroupID] = value;
+  }
+  uint count = gl_NumSubgroups;
+#else
+  sharedPartials[thread] = value;
+  uint count = local_size_x;
+#endif
+
+  barrier();
+
+  // Halve the values left until one remains. Reads are from the upper half and writes to the
+  // lower, so they don't overlap.
+  while (count > 1) {
+    uint upper = (count + 1) / 2;
+    if (thread + upper < count) {
+      sharedPartials[thread] = combine(sharedPartials[thread], sharedPartials[thread + upper]);
+    }
+    barrier();
+    count = upper;
+  }
+
+  return sharedPartials[0];
+}
+
+shared float sharedSums[local_size_x];
+shared float sharedTotal;
+
+// The position of this invocation in scan order. Subgroup scans follow subgroup invocation order,
+// which needn't match gl_LocalInvocationID, so the data is laid out to suit the subgroups.
+uint scanPosition() {
+#if defined(SUBGROUP_ARITHMETIC)
+  return gl_SubgroupID * gl_SubgroupSize + gl_SubgroupInvocationID;
+#else
+  return gl_LocalInvocationID.x;
+#endif
+}
+
+// The sum of the values of invocations before this one in scan order. The sum of all of them is
+// left in sharedTotal.
+float workgroupExclusiveSum(float value) {
+  const uint position = scanPosition();
+
+#if defined(SUBGROUP_ARITHMETIC)
+  float exclusive = subgroupExclusiveAdd(value);
+  if (subgroupElect()) {
+    sharedSums[gl_SubgroupID] = subgroupAdd(value);
+  }
+  barrier();
+
+  // There are few subgroups, so one invocation scans their totals
+  if (position == 0) {
+    float sum = 0.0;
+    for (uint i = 0; i < gl_NumSubgroups; ++i) {
+      float subgroupSum = sharedSums[i];
+      sharedSums[i] = sum;
+      sum += subgroupSum;
+    }
+    sharedTotal = sum;
+  }
+  barrier();
+
+  return sharedSums[gl_SubgroupID] + exclusive;
+#else
+  // Hillis-Steele over shared memory, reading every value of a step before any are replaced
+  sharedSums[position] = value;
+  barrier();
+
+  for (uint offset = 1; offset < local_size_x; offset *= 2) {
+    float sum = sharedSums[position];
+    if (position >= offset) {
+      sum += sharedSums[position - offset];
+    }
+    barrier();
+    sharedSums[position] = sum;
+    barrier();
+  }
+
+  if (position == local_size_x - 1) {
+    sharedTotal = sharedSums[position];
+  }
+  barrier();
+
+  return position > 0 ? sharedSums[position - 1] : 0.0;
+#endif
+}
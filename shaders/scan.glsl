@@ -0,0 +1,58 @@
+#version 450
+
+#include "utils.glsl"
+#include "reduction.glsl"
+
+// Prefix sums each block of the first constants.count elements of Input into Output, and writes
+// the block's total to BlockSums. Where there's more than one block, the scanned totals are then
+// added to the blocks after them by scan_add.glsl.
+
+layout(std430, binding = 0) readonly buffer InputSsbo {
+  NETFLOAT_PACK Input[];
+};
+
+FN_READ(Input)
+
+layout(std430, binding = 1) NETFLOAT_WRITEONLY buffer OutputSsbo {
+  NETFLOAT_PACK Output[];
+};
+
+FN_WRITE(Output)
+
+layout(std430, binding = 2) writeonly buffer BlockSumsSsbo {
+  float BlockSums[];
+};
+
+void main() {
+  // Each invocation scans ITEMS consecutive elements
+  const uint first = (gl_WorkGroupID.x * local_size_x + scanPosition()) * ITEMS;
+
+  float values[ITEMS];
+  float sum = 0.0;
+  for (uint i = 0; i < ITEMS; ++i) {
+    uint index = first + i;
+    values[i] = index < constants.count ? readInput(index) : 0.0;
+    sum += values[i];
+  }
+
+  float running = workgroupExclusiveSum(sum);
+
+  for (uint i = 0; i < ITEMS; ++i) {
+    uint index = first + i;
+    if (index >= constants.count) {
+      break;
+    }
+    if (constants.exclusive != 0) {
+      writeOutput(index, running);
+      running += values[i];
+    }
+    else {
+      running += values[i];
+      writeOutput(index, running);
+    }
+  }
+
+  if (gl_LocalInvocationID.x == 0) {
+    BlockSums[gl_WorkGroupID.x] = sharedTotal;
+  }
+}
@@ -0,0 +1,29 @@
+#version 450
+
+#include "utils.glsl"
+#include "reduction.glsl"
+
+// Adds to each block of scan.glsl's output the exclusive scan of the block totals
+
+layout(std430, binding = 0) buffer DataSsbo {
+  NETFLOAT_PACK Data[];
+};
+
+FN_READ(Data)
+FN_WRITE(Data)
+
+layout(std430, binding = 1) readonly buffer OffsetsSsbo {
+  float Offsets[];
+};
+
+void main() {
+  const uint first = gl_WorkGroupID.x * ITEMS * local_size_x + gl_LocalInvocationID.x;
+  const float offset = Offsets[gl_WorkGroupID.x];
+
+  for (uint i = 0; i < ITEMS; ++i) {
+    uint index = first + i * local_size_x;
+    if (index < constants.count) {
+      writeData(index, readData(index) + offset);
+    }
+  }
+}
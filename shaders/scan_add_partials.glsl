@@ -0,0 +1,26 @@
+#version 450
+
+#include "utils.glsl"
+#include "reduction.glsl"
+
+// As scan_add.glsl, for scan_partials.glsl's output
+
+layout(std430, binding = 0) buffer DataSsbo {
+  float Data[];
+};
+
+layout(std430, binding = 1) readonly buffer OffsetsSsbo {
+  float Offsets[];
+};
+
+void main() {
+  const uint first = gl_WorkGroupID.x * ITEMS * local_size_x + gl_LocalInvocationID.x;
+  const float offset = Offsets[gl_WorkGroupID.x];
+
+  for (uint i = 0; i < ITEMS; ++i) {
+    uint index = first + i * local_size_x;
+    if (index < constants.count) {
+      Data[index] += offset;
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#version 450
+
+#include "utils.glsl"
+#include "reduction.glsl"
+
+// As scan.glsl, but scanning block totals in place
+
+layout(std430, binding = 0) buffer DataSsbo {
+  float Data[];
+};
+
+layout(std430, binding = 1) writeonly buffer BlockSumsSsbo {
+  float BlockSums[];
+};
+
+void main() {
+  const uint first = (gl_WorkGroupID.x * local_size_x + scanPosition()) * ITEMS;
+
+  float values[ITEMS];
+  float sum = 0.0;
+  for (uint i = 0; i < ITEMS; ++i) {
+    uint index = first + i;
+    values[i] = index < constants.count ? Data[index] : 0.0;
+    sum += values[i];
+  }
+
+  float running = workgroupExclusiveSum(sum);
+
+  for (uint i = 0; i < ITEMS; ++i) {
+    uint index = first + i;
+    if (index >= constants.count) {
+      break;
+    }
+    if (constants.exclusive != 0) {
+      Data[index] = running;
+      running += values[i];
+    }
+    else {
+      running += values[i];
+      Data[index] = running;
+    }
+  }
+
+  if (gl_LocalInvocationID.x == 0) {
+    BlockSums[gl_WorkGroupID.x] = sharedTotal;
+  }
+}
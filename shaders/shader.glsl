@@ -2,24 +2,30 @@
 
 #include "utils.glsl"
 
-layout(binding = 0) uniform UniformBufferObject {
+layout(push_constant) uniform PushConstants {
   vec2 a;
   vec2 b;
-} ubo;
+} constants;
 
-layout(std140, binding = 1) readonly buffer ASsbo {
-  vec4 A[];
+layout(std430, binding = 0) readonly buffer ASsbo {
+  NETFLOAT_PACK4 A[];
 };
 
-FN_READ(A)
+FN_READ4(A)
 
-layout(std140, binding = 2) writeonly buffer BSsbo {
-  vec4 B[];
+layout(std430, binding = 1) writeonly buffer BSsbo {
+  NETFLOAT_PACK4 B[];
 };
 
-FN_WRITE(B)
+FN_WRITE4(B)
+FN_SIZE4(B)
 
+// Four elements per invocation
 void main() {
   const uint index = gl_GlobalInvocationID.x;
-  writeB(index, readA(index) * 2.0 + ubo.a.x + ubo.a.y + ubo.b.x + ubo.b.y);
+  if (index >= size4B()) {
+    return;
+  }
+  write4B(index, read4A(index) * 2.0 + constants.a.x + constants.a.y + constants.b.x
+    + constants.b.y);
 }
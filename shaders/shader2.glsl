@@ -2,19 +2,24 @@
 
 #include "utils.glsl"
 
-layout(std140, binding = 0) readonly buffer BSsbo {
-  vec4 B[];
+layout(std430, binding = 0) readonly buffer BSsbo {
+  NETFLOAT_PACK4 B[];
 };
 
-FN_READ(B)
+FN_READ4(B)
 
-layout(std140, binding = 1) writeonly buffer ASsbo {
-  vec4 A[];
+layout(std430, binding = 1) writeonly buffer ASsbo {
+  NETFLOAT_PACK4 A[];
 };
 
-FN_WRITE(A)
+FN_WRITE4(A)
+FN_SIZE4(A)
 
+// Four elements per invocation
 void main() {
   const uint index = gl_GlobalInvocationID.x;
-  writeA(index, readB(index) * 3.0);
+  if (index >= size4A()) {
+    return;
+  }
+  write4A(index, read4B(index) * 3.0);
 }
@@ -1,14 +1,156 @@
+// Buffers of netfloat_t are std430 arrays, accessed through the FN_* functions, which convert
+// to and from float. There are two layouts:
+//
+//   NETFLOAT_PACK X[], with FN_READ, FN_WRITE and FN_SIZE, accesses one element at a time.
+//   NETFLOAT_PACK4 X[], with FN_READ4, FN_WRITE4 and FN_SIZE4, accesses four consecutive
+//   elements as a vec4. Shaders using it should process four elements per invocation and be
+//   compiled with ShaderDesc::elementsPerInvocation of 4. The buffer must hold a multiple of
+//   four elements, which the Vulkan backend checks when binding it, as length() would otherwise
+//   silently leave out the remainder.
+//
+// Without 16-bit storage support, 16-bit elements are packed into uints. Single elements are
+// then written with atomics so that neighbouring invocations don't clobber each other's halves,
+// which means such buffers can't be writeonly, so declare scalar outputs NETFLOAT_WRITEONLY.
+// Whole vec4s need no atomics. The Vulkan backend pads buffers of an odd number of elements to a
+// whole uint, so FN_SIZE then counts one element more than was allocated. Shaders that must
+// handle odd sizes exactly should take the element count as a parameter.
+
+#if defined(NETFLOAT_16BIT_STORAGE)
+#extension GL_EXT_shader_16bit_storage : require
+#endif
+
+#if defined(NETFLOAT_FP16) || defined(NETFLOAT_BF16)
+
+// Rounds to nearest even, keeping NaNs quiet, as on the host
+uint floatToBfloat16(float val) {
+  uint bits = floatBitsToUint(val);
+  if ((bits & 0x7fffffffu) > 0x7f800000u) {
+    return (bits >> 16) | 0x40u;
+  }
+  return (bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16;
+}
+
+#if defined(NETFLOAT_FP16)
+float netfloatFromBits(uint bits) {
+  return unpackHalf2x16(bits).x;
+}
+
+uint netfloatToBits(float val) {
+  return packHalf2x16(vec2(val, 0.0));
+}
+
+vec4 netfloat4FromBits(uvec2 bits) {
+  return vec4(unpackHalf2x16(bits.x), unpackHalf2x16(bits.y));
+}
+
+uvec2 netfloat4ToBits(vec4 val) {
+  return uvec2(packHalf2x16(val.xy), packHalf2x16(val.zw));
+}
+#else
+float netfloatFromBits(uint bits) {
+  return uintBitsToFloat(bits << 16);
+}
+
+uint netfloatToBits(float val) {
+  return floatToBfloat16(val);
+}
+
+vec4 netfloat4FromBits(uvec2 bits) {
+  return uintBitsToFloat(uvec4(bits.x << 16, bits.x & 0xffff0000u, bits.y << 16,
+    bits.y & 0xffff0000u));
+}
+
+uvec2 netfloat4ToBits(vec4 val) {
+  return uvec2(floatToBfloat16(val.x) | (floatToBfloat16(val.y) << 16),
+    floatToBfloat16(val.z) | (floatToBfloat16(val.w) << 16));
+}
+#endif
+
+#endif
+
+#if defined(NETFLOAT_FP16) && defined(NETFLOAT_16BIT_STORAGE)
+
+#define NETFLOAT_PACK float16_t
+#define NETFLOAT_PACK4 f16vec4
+#define NETFLOAT_PER_PACK 1
+#define NETFLOAT_WRITEONLY writeonly
+#define NETFLOAT_LOAD(BUF, pos) float(BUF[pos])
+#define NETFLOAT_STORE(BUF, pos, val) BUF[pos] = float16_t(val)
+#define NETFLOAT_LOAD4(BUF, i) vec4(BUF[i])
+#define NETFLOAT_STORE4(BUF, i, val) BUF[i] = f16vec4(val)
+
+#elif defined(NETFLOAT_BF16) && defined(NETFLOAT_16BIT_STORAGE)
+
+#define NETFLOAT_PACK uint16_t
+#define NETFLOAT_PACK4 u16vec4
+#define NETFLOAT_PER_PACK 1
+#define NETFLOAT_WRITEONLY writeonly
+#define NETFLOAT_LOAD(BUF, pos) uintBitsToFloat(uint(BUF[pos]) << 16)
+#define NETFLOAT_STORE(BUF, pos, val) BUF[pos] = uint16_t(floatToBfloat16(val))
+#define NETFLOAT_LOAD4(BUF, i) uintBitsToFloat(uvec4(BUF[i]) << 16)
+#define NETFLOAT_STORE4(BUF, i, val) BUF[i] = u16vec4(floatToBfloat16((val).x), \
+  floatToBfloat16((val).y), floatToBfloat16((val).z), floatToBfloat16((val).w))
+
+#elif defined(NETFLOAT_FP16) || defined(NETFLOAT_BF16)
+
+#define NETFLOAT_PACK uint
+#define NETFLOAT_PACK4 uvec2
+#define NETFLOAT_PER_PACK 2
+#define NETFLOAT_WRITEONLY
+#define NETFLOAT_LOAD(BUF, pos) netfloatFromBits((BUF[(pos) / 2] >> ((pos) % 2 * 16)) & 0xffff)
+#define NETFLOAT_STORE(BUF, pos, val) \
+  atomicAnd(BUF[(pos) / 2], 0xffff0000u >> ((pos) % 2 * 16)); \
+  atomicOr(BUF[(pos) / 2], netfloatToBits(val) << ((pos) % 2 * 16))
+#define NETFLOAT_LOAD4(BUF, i) netfloat4FromBits(BUF[i])
+#define NETFLOAT_STORE4(BUF, i, val) BUF[i] = netfloat4ToBits(val)
+
+#else
+
+#define NETFLOAT_PACK float
+#define NETFLOAT_PACK4 vec4
+#define NETFLOAT_PER_PACK 1
+#define NETFLOAT_WRITEONLY writeonly
+#define NETFLOAT_LOAD(BUF, pos) BUF[pos]
+#define NETFLOAT_STORE(BUF, pos, val) BUF[pos] = (val)
+#define NETFLOAT_LOAD4(BUF, i) BUF[i]
+#define NETFLOAT_STORE4(BUF, i, val) BUF[i] = (val)
+
+#endif
+
 #define FN_READ(BUF) \
   float read##BUF(uint pos) { \
-    return BUF[pos / 4][pos % 4]; \
+    return NETFLOAT_LOAD(BUF, pos); \
   }
 
 #define FN_WRITE(BUF) \
   void write##BUF(uint pos, float val) { \
-    BUF[pos / 4][pos % 4] = val; \
+    NETFLOAT_STORE(BUF, pos, val); \
+  }
+
+// In elements
+#define FN_SIZE(BUF) \
+  uint size##BUF() { \
+    return BUF.length() * NETFLOAT_PER_PACK; \
+  }
+
+// Reads elements 4i to 4i + 3
+#define FN_READ4(BUF) \
+  vec4 read4##BUF(uint i) { \
+    return NETFLOAT_LOAD4(BUF, i); \
+  }
+
+#define FN_WRITE4(BUF) \
+  void write4##BUF(uint i, vec4 val) { \
+    NETFLOAT_STORE4(BUF, i, val); \
+  }
+
+// In vec4s
+#define FN_SIZE4(BUF) \
+  uint size4##BUF() { \
+    return BUF.length(); \
   }
 
 layout(constant_id = 0) const uint local_size_x = 1;
 layout(constant_id = 1) const uint local_size_y = 1;
 layout(constant_id = 2) const uint local_size_z = 1;
-layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2) in;
\ No newline at end of file
+layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2) in;
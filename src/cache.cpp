@@ -0,0 +1,64 @@
+#include "cache.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+std::filesystem::path cacheDirectory() {
+  std::filesystem::path directory;
+
+  if (const char* overridePath = std::getenv("VULKAN_COMPUTE_CACHE_DIR")) {
+    directory = overridePath;
+  }
+  else if (const char* xdgCache = std::getenv("XDG_CACHE_HOME")) {
+    directory = std::filesystem::path(xdgCache) / "vulkan_compute";
+  }
+  else if (const char* home = std::getenv("HOME")) {
+    directory = std::filesystem::path(home) / ".cache" / "vulkan_compute";
+  }
+  else {
+    directory = std::filesystem::temp_directory_path() / "vulkan_compute";
+  }
+
+  // Caching is best effort, so failure here just results in cache misses
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+
+  return directory;
+}
+
+void writeFileAtomic(const std::filesystem::path& path, const void* data, size_t size) {
+  std::stringstream suffix;
+  suffix << ".tmp" << std::random_device{}();
+
+  std::filesystem::path tempPath = path;
+  tempPath += suffix.str();
+
+  {
+    std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char*>(data), size);
+    if (!stream.good()) {
+      std::error_code error;
+      std::filesystem::remove(tempPath, error);
+      return;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error) {
+    std::filesystem::remove(tempPath, error);
+  }
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  uint64_t hash = seed;
+
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
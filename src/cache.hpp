@@ -0,0 +1,15 @@
+#pragma once
+
+#include <filesystem>
+#include <cstdint>
+#include <cstddef>
+
+// Directory for data persisted between runs. Overridden by VULKAN_COMPUTE_CACHE_DIR.
+std::filesystem::path cacheDirectory();
+
+// Writes via a temporary file and rename, so concurrent readers never see a partial file.
+// Failures are ignored, since caches are best effort.
+void writeFileAtomic(const std::filesystem::path& path, const void* data, size_t size);
+
+// 64-bit FNV-1a. Stable across runs and platforms, so suitable for cache keys.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
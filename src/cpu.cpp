@@ -0,0 +1,408 @@
+#include "cpu.hpp"
+#include "exception.hpp"
+#include "slot_map.hpp"
+#include "timing_stats.hpp"
+#include "work_stealing_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <new>
+
+namespace {
+
+// Keeps buffers aligned for vector loads and off each other's cache lines
+const size_t BufferAlignment = 64;
+// Invocations per row segment, the unit of work handed to threads
+const uint32_t SegmentSize = 1024;
+// Chunks per thread before stealing kicks in
+const size_t ChunksPerThread = 8;
+
+std::map<std::string, CpuKernel>& kernelRegistry() {
+  static std::map<std::string, CpuKernel> registry;
+  return registry;
+}
+
+struct Buffer {
+  char* data = nullptr;
+  size_t size = 0;
+};
+
+struct Shader {
+  std::string sourcePath;
+  CpuKernel kernel;
+  GpuBufferBindings bufferBindings;
+  std::array<uint32_t, 3> workgroupSize{ 1, 1, 1 };
+};
+
+double microsecondsSince(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+class Cpu : public Gpu {
+  public:
+    explicit Cpu(size_t threadCount);
+
+    GpuBuffer allocateBuffer(size_t size, GpuBufferFlags flags) override;
+    void freeBuffer(GpuBufferHandle buffer) override;
+    ShaderHandle compileShader(const std::string& sourcePath,
+      const GpuBufferBindings& bufferBindings, const Size3& workgroupSize) override;
+    std::vector<ShaderHandle> compileShaders(const std::vector<ShaderDesc>& shaders) override;
+    void destroyShader(ShaderHandle shader) override;
+    void submitBufferData(GpuBufferHandle buffer, const void* data) override;
+    void submitBufferData(GpuBufferHandle buffer, const void* data, size_t offset,
+      size_t size) override;
+    void submitBufferRegions(GpuBufferHandle buffer, const void* data,
+      const std::vector<GpuBufferRegion>& regions) override;
+    void queueShader(ShaderHandle shaderHandle, const Size3& problemSize,
+      const void* pushConstants, size_t pushConstantsSize) override;
+    void queueShaderWithBindings(ShaderHandle shaderHandle, const GpuBufferBindings& bufferBindings,
+      const Size3& problemSize, const void* pushConstants, size_t pushConstantsSize) override;
+    std::array<uint32_t, 3> tuneWorkgroupSize(ShaderHandle shaderHandle,
+      const Size3& problemSize, const void* pushConstants, size_t pushConstantsSize) override;
+    void retrieveBuffer(GpuBufferHandle buffer, void* data) override;
+    void retrieveBuffer(GpuBufferHandle buffer, void* data, size_t offset, size_t size) override;
+    void retrieveBufferRegions(GpuBufferHandle buffer, void* data,
+      const std::vector<GpuBufferRegion>& regions) override;
+    void retrieveBufferAsync(GpuBufferHandle buffer, void* data, size_t offset,
+      size_t size) override;
+    void flushQueue() override;
+    GpuTicket flushQueueAsync() override;
+    bool isComplete(GpuTicket ticket) override;
+    void wait(GpuTicket ticket) override;
+    void onComplete(GpuTicket ticket, std::function<void()> callback) override;
+    void beginSequence() override;
+    GpuSequenceHandle endSequence() override;
+    void queueSequence(GpuSequenceHandle sequence) override;
+    void setProfilingEnabled(bool enabled) override;
+    GpuProfile profile() override;
+    void resetProfile() override;
+
+    ~Cpu();
+
+  private:
+    void dispatch(ShaderHandle shaderHandle, const GpuBufferBindings& bufferBindings,
+      const Size3& problemSize, const void* pushConstants);
+    void checkRegions(const Buffer& buffer, const std::vector<GpuBufferRegion>& regions) const;
+
+    WorkStealingPool m_pool;
+    SlotMap<Buffer> m_buffers;
+    SlotMap<Shader> m_shaders;
+    // Each sequence is its recorded dispatches
+    std::vector<std::vector<std::function<void()>>> m_sequences;
+    bool m_recordingSequence = false;
+    GpuTicket m_nextTicket = 1;
+    bool m_profiling = false;
+    std::map<ShaderHandle, std::vector<double>> m_shaderTimings; // Microseconds
+    std::vector<double> m_uploadTimings;
+    std::vector<double> m_downloadTimings;
+};
+
+Cpu::Cpu(size_t threadCount)
+  : m_pool(threadCount) {}
+
+GpuBuffer Cpu::allocateBuffer(size_t size, GpuBufferFlags) {
+  size_t paddedSize = std::max<size_t>(size + BufferAlignment - 1, 1) / BufferAlignment
+    * BufferAlignment;
+
+  Buffer buffer;
+  buffer.size = size;
+  buffer.data = static_cast<char*>(operator new(paddedSize, std::align_val_t(BufferAlignment)));
+  memset(buffer.data, 0, paddedSize);
+
+  GpuBuffer gpuBuffer;
+  gpuBuffer.handle = m_buffers.insert(buffer);
+  gpuBuffer.data = buffer.data;
+
+  return gpuBuffer;
+}
+
+// Nothing is ever in flight, so memory is released immediately
+void Cpu::freeBuffer(GpuBufferHandle bufferHandle) {
+  Buffer buffer = m_buffers.erase(bufferHandle);
+  operator delete(buffer.data, std::align_val_t(BufferAlignment));
+}
+
+ShaderHandle Cpu::compileShader(const std::string& sourcePath,
+  const GpuBufferBindings& bufferBindings, const Size3& workgroupSize) {
+
+  return compileShaders({ ShaderDesc{ sourcePath, bufferBindings, workgroupSize } })[0];
+}
+
+std::vector<ShaderHandle> Cpu::compileShaders(const std::vector<ShaderDesc>& shaders) {
+  const auto& registry = kernelRegistry();
+
+  std::vector<ShaderHandle> handles;
+  for (const ShaderDesc& desc : shaders) {
+    CpuKernel kernel = desc.cpuKernel;
+    if (!kernel) {
+      auto registered = registry.find(desc.sourcePath);
+      ASSERT_MSG(registered != registry.end(), "No CPU kernel registered for "
+        << desc.sourcePath);
+
+      kernel = registered->second;
+    }
+
+    for (GpuBufferHandle buffer : desc.bufferBindings) {
+      ASSERT_MSG(m_buffers.contains(buffer), "Invalid or stale handle " << buffer);
+    }
+
+    handles.push_back(m_shaders.insert(Shader{ desc.sourcePath, kernel, desc.bufferBindings,
+      desc.workgroupSize }));
+  }
+
+  return handles;
+}
+
+void Cpu::destroyShader(ShaderHandle shaderHandle) {
+  m_shaders.erase(shaderHandle);
+}
+
+void Cpu::submitBufferData(GpuBufferHandle bufferHandle, const void* data) {
+  submitBufferData(bufferHandle, data, 0, m_buffers[bufferHandle].size);
+}
+
+void Cpu::submitBufferData(GpuBufferHandle bufferHandle, const void* data, size_t offset,
+  size_t size) {
+
+  const Buffer& buffer = m_buffers[bufferHandle];
+  checkRegions(buffer, {{ offset, size }});
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  if (buffer.data + offset != data) {
+    memcpy(buffer.data + offset, data, size);
+  }
+
+  if (m_profiling) {
+    m_uploadTimings.push_back(microsecondsSince(startTime));
+  }
+}
+
+void Cpu::submitBufferRegions(GpuBufferHandle bufferHandle, const void* data,
+  const std::vector<GpuBufferRegion>& regions) {
+
+  const Buffer& buffer = m_buffers[bufferHandle];
+  checkRegions(buffer, regions);
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  const char* src = static_cast<const char*>(data);
+  if (src != buffer.data) {
+    for (const GpuBufferRegion& region : regions) {
+      memcpy(buffer.data + region.offset, src + region.offset, region.size);
+    }
+  }
+
+  if (m_profiling) {
+    m_uploadTimings.push_back(microsecondsSince(startTime));
+  }
+}
+
+void Cpu::checkRegions(const Buffer& buffer, const std::vector<GpuBufferRegion>& regions) const {
+  for (const GpuBufferRegion& region : regions) {
+    ASSERT_MSG(region.offset <= buffer.size && region.size <= buffer.size - region.offset,
+      "Region at offset " << region.offset << " of size " << region.size
+      << " exceeds buffer of size " << buffer.size);
+  }
+}
+
+void Cpu::queueShader(ShaderHandle shaderHandle, const Size3& problemSize,
+  const void* pushConstants, size_t pushConstantsSize) {
+
+  queueShaderWithBindings(shaderHandle, m_shaders[shaderHandle].bufferBindings, problemSize,
+    pushConstants, pushConstantsSize);
+}
+
+void Cpu::queueShaderWithBindings(ShaderHandle shaderHandle,
+  const GpuBufferBindings& bufferBindings, const Size3& problemSize, const void* pushConstants,
+  size_t pushConstantsSize) {
+
+  ASSERT_MSG(pushConstantsSize == 0 || pushConstants != nullptr, "Push constants missing");
+
+  if (m_recordingSequence) {
+    const char* bytes = static_cast<const char*>(pushConstants);
+    std::vector<char> constants(bytes, bytes + pushConstantsSize);
+    std::array<uint32_t, 3> size = problemSize;
+
+    m_sequences.back().push_back([=]() {
+      dispatch(shaderHandle, bufferBindings, size, constants.empty() ? nullptr : constants.data());
+    });
+
+    return;
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  dispatch(shaderHandle, bufferBindings, problemSize, pushConstants);
+
+  if (m_profiling) {
+    m_shaderTimings[shaderHandle].push_back(microsecondsSince(startTime));
+  }
+}
+
+void Cpu::dispatch(ShaderHandle shaderHandle, const GpuBufferBindings& bufferBindings,
+  const Size3& problemSize, const void* pushConstants) {
+
+  const Shader& shader = m_shaders[shaderHandle];
+
+  CpuKernelArgs args;
+  for (GpuBufferHandle handle : bufferBindings) {
+    const Buffer& buffer = m_buffers[handle];
+    args.buffers.push_back(buffer.data);
+    args.bufferSizes.push_back(buffer.size);
+  }
+  args.pushConstants = pushConstants;
+  args.problemSize = problemSize;
+
+  // Rows are split into segments so that long rows still spread across threads
+  size_t segmentsPerRow = (problemSize[0] + SegmentSize - 1) / SegmentSize;
+  size_t rows = static_cast<size_t>(problemSize[1]) * problemSize[2];
+  size_t count = segmentsPerRow * rows;
+  size_t grainSize = std::max<size_t>(1, count / (m_pool.threadCount() * ChunksPerThread));
+
+  m_pool.parallelFor(count, grainSize, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      size_t row = i / segmentsPerRow;
+      uint32_t xBegin = static_cast<uint32_t>(i % segmentsPerRow) * SegmentSize;
+      uint32_t xEnd = std::min(xBegin + SegmentSize, problemSize[0]);
+
+      shader.kernel(args, xBegin, xEnd, row % problemSize[1], row / problemSize[1]);
+    }
+  });
+}
+
+// There are no workgroups on the CPU, so there's nothing to tune
+std::array<uint32_t, 3> Cpu::tuneWorkgroupSize(ShaderHandle shaderHandle, const Size3&,
+  const void*, size_t) {
+
+  return m_shaders[shaderHandle].workgroupSize;
+}
+
+void Cpu::retrieveBuffer(GpuBufferHandle bufferHandle, void* data) {
+  retrieveBuffer(bufferHandle, data, 0, m_buffers[bufferHandle].size);
+}
+
+void Cpu::retrieveBuffer(GpuBufferHandle bufferHandle, void* data, size_t offset, size_t size) {
+  const Buffer& buffer = m_buffers[bufferHandle];
+  checkRegions(buffer, {{ offset, size }});
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  if (buffer.data + offset != data) {
+    memcpy(data, buffer.data + offset, size);
+  }
+
+  if (m_profiling) {
+    m_downloadTimings.push_back(microsecondsSince(startTime));
+  }
+}
+
+void Cpu::retrieveBufferRegions(GpuBufferHandle bufferHandle, void* data,
+  const std::vector<GpuBufferRegion>& regions) {
+
+  const Buffer& buffer = m_buffers[bufferHandle];
+  checkRegions(buffer, regions);
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  char* dst = static_cast<char*>(data);
+  if (dst != buffer.data) {
+    for (const GpuBufferRegion& region : regions) {
+      memcpy(dst + region.offset, buffer.data + region.offset, region.size);
+    }
+  }
+
+  if (m_profiling) {
+    m_downloadTimings.push_back(microsecondsSince(startTime));
+  }
+}
+
+// Queued work has already run, so there's nothing to wait for
+void Cpu::retrieveBufferAsync(GpuBufferHandle bufferHandle, void* data, size_t offset,
+  size_t size) {
+
+  retrieveBuffer(bufferHandle, data, offset, size);
+}
+
+void Cpu::flushQueue() {}
+
+// Work has already run by the time it's flushed, so every ticket is complete on issue
+GpuTicket Cpu::flushQueueAsync() {
+  return m_nextTicket++;
+}
+
+bool Cpu::isComplete(GpuTicket ticket) {
+  ASSERT_MSG(ticket < m_nextTicket, "Ticket " << ticket << " has not been issued");
+  return true;
+}
+
+void Cpu::wait(GpuTicket ticket) {
+  ASSERT_MSG(ticket < m_nextTicket, "Ticket " << ticket << " has not been issued");
+}
+
+void Cpu::onComplete(GpuTicket ticket, std::function<void()> callback) {
+  ASSERT_MSG(ticket < m_nextTicket, "Ticket " << ticket << " has not been issued");
+  callback();
+}
+
+void Cpu::beginSequence() {
+  ASSERT_MSG(!m_recordingSequence, "Already recording a sequence");
+
+  m_sequences.emplace_back();
+  m_recordingSequence = true;
+}
+
+GpuSequenceHandle Cpu::endSequence() {
+  ASSERT_MSG(m_recordingSequence, "Not recording a sequence");
+
+  m_recordingSequence = false;
+  return m_sequences.size() - 1;
+}
+
+void Cpu::queueSequence(GpuSequenceHandle sequence) {
+  ASSERT_MSG(!m_recordingSequence, "Sequences can't be nested");
+  ASSERT_MSG(sequence < m_sequences.size(), "No sequence with handle " << sequence);
+
+  for (auto& dispatch : m_sequences[sequence]) {
+    dispatch();
+  }
+}
+
+void Cpu::setProfilingEnabled(bool enabled) {
+  m_profiling = enabled;
+}
+
+GpuProfile Cpu::profile() {
+  GpuProfile profile;
+  for (const auto& entry : m_shaderTimings) {
+    profile.shaders[entry.first] = timingStats(entry.second);
+  }
+  profile.uploads = timingStats(m_uploadTimings);
+  profile.downloads = timingStats(m_downloadTimings);
+
+  return profile;
+}
+
+void Cpu::resetProfile() {
+  m_shaderTimings.clear();
+  m_uploadTimings.clear();
+  m_downloadTimings.clear();
+}
+
+Cpu::~Cpu() {
+  m_buffers.forEach([](const Buffer& buffer) {
+    operator delete(buffer.data, std::align_val_t(BufferAlignment));
+  });
+}
+
+}
+
+void registerCpuKernel(const std::string& sourcePath, CpuKernel kernel) {
+  kernelRegistry()[sourcePath] = std::move(kernel);
+}
+
+GpuPtr createCpuGpu(size_t threadCount) {
+  return std::make_unique<Cpu>(threadCount);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "gpu.hpp"
+#include <string>
+#include <vector>
+
+// What a CPU kernel sees of a dispatch. Buffers are indexed by binding, as in GpuBufferBindings.
+struct CpuKernelArgs {
+  std::vector<void*> buffers;
+  std::vector<size_t> bufferSizes;
+  const void* pushConstants = nullptr;
+  std::array<uint32_t, 3> problemSize{ 1, 1, 1 };
+};
+
+// Registers the C++ equivalent of the shader at sourcePath, which compileShader() on the CPU
+// backend then returns in place of the compiled shader
+void registerCpuKernel(const std::string& sourcePath, CpuKernel kernel);
+
+// Runs registered kernels on host threads. Queued work executes before the call that queues it
+// returns, and buffers are plain host memory that's always mapped. A threadCount of 0 uses one
+// thread per hardware core.
+GpuPtr createCpuGpu(size_t threadCount = 0);
@@ -0,0 +1,139 @@
+#include "descriptor_allocator.hpp"
+#include "vulkan_utils.hpp"
+#include <array>
+
+namespace {
+
+const uint32_t SetsPerPool = 256;
+const uint32_t StorageDescriptorsPerPool = 1024;
+const uint32_t UniformDescriptorsPerPool = 256;
+
+}
+
+DescriptorAllocator::DescriptorAllocator(VkDevice device)
+  : m_device(device) {}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout,
+  const DescriptorCounts& counts) {
+
+  ASSERT_MSG(counts.storage <= StorageDescriptorsPerPool &&
+    counts.uniform <= UniformDescriptorsPerPool, "Descriptor set needs more descriptors than a "
+    "pool holds");
+
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+  // Tracked capacity doesn't account for fragmentation, so any failure from an existing pool
+  // moves on to a new one
+  size_t pool = findPool(counts);
+  if (pool < m_pools.size() &&
+    allocateFromPool(pool, layout, counts, descriptorSet) == VK_SUCCESS) {
+
+    return descriptorSet;
+  }
+
+  pool = createPool();
+  VK_CHECK(allocateFromPool(pool, layout, counts, descriptorSet),
+    "Failed to allocate descriptor set from new pool");
+
+  return descriptorSet;
+}
+
+// Returns m_pools.size() if no pool has room
+size_t DescriptorAllocator::findPool(const DescriptorCounts& counts) {
+  auto fits = [&](const Pool& pool) {
+    return pool.sets > 0 && pool.remaining.storage >= counts.storage &&
+      pool.remaining.uniform >= counts.uniform;
+  };
+
+  if (m_current < m_pools.size() && fits(m_pools[m_current])) {
+    return m_current;
+  }
+
+  // Other pools only regain room when sets are freed
+  if (m_freed) {
+    for (size_t i = 0; i < m_pools.size(); ++i) {
+      if (fits(m_pools[i])) {
+        m_current = i;
+        return i;
+      }
+    }
+    m_freed = false;
+  }
+
+  return m_pools.size();
+}
+
+VkResult DescriptorAllocator::allocateFromPool(size_t pool, VkDescriptorSetLayout layout,
+  const DescriptorCounts& counts, VkDescriptorSet& descriptorSet) {
+
+  Pool& entry = m_pools[pool];
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = entry.pool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &layout;
+
+  VkResult result = vkAllocateDescriptorSets(m_device, &allocInfo, &descriptorSet);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  --entry.sets;
+  entry.remaining.storage -= counts.storage;
+  entry.remaining.uniform -= counts.uniform;
+
+  m_owners[descriptorSet] = Owner{ pool, counts };
+  return result;
+}
+
+void DescriptorAllocator::free(VkDescriptorSet descriptorSet) {
+  auto i = m_owners.find(descriptorSet);
+  ASSERT_MSG(i != m_owners.end(), "Attempt to free descriptor set not owned by allocator");
+
+  Pool& pool = m_pools[i->second.pool];
+
+  VK_CHECK(vkFreeDescriptorSets(m_device, pool.pool, 1, &descriptorSet),
+    "Failed to free descriptor set");
+
+  ++pool.sets;
+  pool.remaining.storage += i->second.counts.storage;
+  pool.remaining.uniform += i->second.counts.uniform;
+  m_freed = true;
+
+  m_owners.erase(i);
+}
+
+size_t DescriptorAllocator::createPool() {
+  std::array<VkDescriptorPoolSize, 2> poolSizes{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[0].descriptorCount = StorageDescriptorsPerPool;
+
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[1].descriptorCount = UniformDescriptorsPerPool;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = poolSizes.size();
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = SetsPerPool;
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+
+  Pool pool;
+  pool.sets = SetsPerPool;
+  pool.remaining = { StorageDescriptorsPerPool, UniformDescriptorsPerPool };
+
+  VK_CHECK(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &pool.pool),
+    "Failed to create descriptor pool");
+
+  m_pools.push_back(pool);
+  m_current = m_pools.size() - 1;
+
+  return m_current;
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+  for (const Pool& pool : m_pools) {
+    vkDestroyDescriptorPool(m_device, pool.pool, nullptr);
+  }
+}
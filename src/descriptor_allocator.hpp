@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <unordered_map>
+#include <vector>
+
+// Descriptors of each type in a set
+struct DescriptorCounts {
+  uint32_t storage = 0;
+  uint32_t uniform = 0;
+};
+
+// Allocates descriptor sets from a chain of pools, creating another pool whenever the existing
+// ones are exhausted. Each pool's remaining capacity is tracked, so exhaustion is detected without
+// relying on VK_ERROR_OUT_OF_POOL_MEMORY, which Vulkan 1.0 lacks.
+class DescriptorAllocator {
+  public:
+    explicit DescriptorAllocator(VkDevice device);
+
+    // counts must match the layout's bindings
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout, const DescriptorCounts& counts);
+    void free(VkDescriptorSet descriptorSet);
+
+    ~DescriptorAllocator();
+
+  private:
+    struct Pool {
+      VkDescriptorPool pool = VK_NULL_HANDLE;
+      uint32_t sets = 0;          // Remaining
+      DescriptorCounts remaining;
+    };
+
+    struct Owner {
+      size_t pool;
+      DescriptorCounts counts;
+    };
+
+    size_t createPool();
+    size_t findPool(const DescriptorCounts& counts);
+    VkResult allocateFromPool(size_t pool, VkDescriptorSetLayout layout,
+      const DescriptorCounts& counts, VkDescriptorSet& descriptorSet);
+
+    VkDevice m_device;
+    std::vector<Pool> m_pools;
+    size_t m_current = 0;   // Where allocation is tried first
+    bool m_freed = false;   // Whether sets have been freed since older pools were last searched
+    std::unordered_map<VkDescriptorSet, Owner> m_owners;
+};
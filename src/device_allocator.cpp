@@ -0,0 +1,313 @@
+#include "device_allocator.hpp"
+#include "vulkan_utils.hpp"
+#include <algorithm>
+
+namespace {
+
+const VkDeviceSize MaxBlockSize = 64 * 1024 * 1024;
+
+}
+
+DeviceAllocator::DeviceAllocator(VkPhysicalDevice physicalDevice, VkDevice device)
+  : m_device(device) {
+
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  m_maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+  m_nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+}
+
+const VkPhysicalDeviceMemoryProperties& DeviceAllocator::memoryProperties() const {
+  return m_memoryProperties;
+}
+
+bool DeviceAllocator::tryFindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties,
+  uint32_t& memoryType) const {
+
+  for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i) {
+    if (typeFilter & (1 << i) &&
+      (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+
+      memoryType = i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+uint32_t DeviceAllocator::findMemoryType(uint32_t typeFilter,
+  VkMemoryPropertyFlags properties) const {
+
+  uint32_t memoryType = 0;
+  if (!tryFindMemoryType(typeFilter, properties, memoryType)) {
+    EXCEPTION("Failed to find suitable memory type");
+  }
+
+  return memoryType;
+}
+
+VkDeviceSize DeviceAllocator::preferredBlockSize(uint32_t memoryType) const {
+  uint32_t heapIndex = m_memoryProperties.memoryTypes[memoryType].heapIndex;
+  VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[heapIndex].size;
+
+  // Small heaps (e.g. host-visible BAR memory) shouldn't be consumed by a single block
+  return std::min(MaxBlockSize, heapSize / 8);
+}
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements& requirements,
+  VkMemoryPropertyFlags properties, VkMemoryPropertyFlags preferredProperties) {
+
+  uint32_t memoryType = 0;
+  if (!tryFindMemoryType(requirements.memoryTypeBits, properties | preferredProperties,
+    memoryType)) {
+
+    memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+  }
+
+  VkDeviceSize blockSize = preferredBlockSize(memoryType);
+  Pool& pool = m_pools[memoryType];
+
+  VkDeviceSize size = requirements.size;
+  VkDeviceSize alignment = requirements.alignment;
+
+  // Flushes and invalidates are widened to whole atoms, so neighbouring allocations mustn't share
+  // one, or flushing one could overwrite the other's device writes with stale host data
+  VkMemoryPropertyFlags flags = m_memoryProperties.memoryTypes[memoryType].propertyFlags;
+  if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+    !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+
+    alignment = std::max(alignment, m_nonCoherentAtomSize);
+    size = alignUp(size, m_nonCoherentAtomSize);
+  }
+
+  DeviceAllocation allocation;
+  allocation.memoryType = memoryType;
+  allocation.size = size;
+
+  Block* block = nullptr;
+
+  if (size > blockSize / 2) {
+    block = createBlock(memoryType, size, true);
+    allocation.offset = 0;
+  }
+  else {
+    for (auto& candidate : pool) {
+      if (!candidate->dedicated && allocateFromBlock(*candidate, size, alignment,
+        allocation.offset)) {
+
+        block = candidate.get();
+        break;
+      }
+    }
+
+    if (block == nullptr) {
+      block = createBlock(memoryType, blockSize, false);
+      bool success = allocateFromBlock(*block, size, alignment, allocation.offset);
+
+      ASSERT_MSG(success, "Failed to allocate " << size << " bytes from new block");
+    }
+  }
+
+  allocation.memory = block->memory;
+  allocation.data = block->data == nullptr ? nullptr : block->data + allocation.offset;
+
+  return allocation;
+}
+
+void DeviceAllocator::free(const DeviceAllocation& allocation) {
+  Pool& pool = m_pools[allocation.memoryType];
+
+  auto i = std::find_if(pool.begin(), pool.end(), [&](const std::unique_ptr<Block>& block) {
+    return block->memory == allocation.memory;
+  });
+
+  ASSERT_MSG(i != pool.end(), "Attempt to free memory not owned by allocator");
+
+  Block& block = **i;
+
+  if (!block.dedicated) {
+    freeToBlock(block, allocation.offset, allocation.size);
+
+    if (block.used > 0) {
+      return;
+    }
+
+    // Keep one empty block around to avoid thrashing when allocations come and go
+    size_t emptyBlocks = std::count_if(pool.begin(), pool.end(),
+      [](const std::unique_ptr<Block>& b) { return !b->dedicated && b->used == 0; });
+
+    if (emptyBlocks < 2) {
+      return;
+    }
+  }
+
+  destroyBlock(block);
+  pool.erase(i);
+}
+
+bool DeviceAllocator::isCoherent(const DeviceAllocation& allocation) const {
+  VkMemoryPropertyFlags flags = m_memoryProperties.memoryTypes[allocation.memoryType].propertyFlags;
+  return flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+const DeviceAllocator::Block& DeviceAllocator::findBlock(const DeviceAllocation& allocation) const {
+  const Pool& pool = m_pools[allocation.memoryType];
+
+  auto i = std::find_if(pool.begin(), pool.end(), [&](const std::unique_ptr<Block>& block) {
+    return block->memory == allocation.memory;
+  });
+
+  ASSERT_MSG(i != pool.end(), "Memory not owned by allocator");
+
+  return **i;
+}
+
+// Ranges must be aligned to nonCoherentAtomSize, or extend to the end of the memory object
+VkMappedMemoryRange DeviceAllocator::mappedRange(const DeviceAllocation& allocation,
+  VkDeviceSize offset, VkDeviceSize size) const {
+
+  const Block& block = findBlock(allocation);
+
+  VkDeviceSize begin = allocation.offset + offset;
+  VkDeviceSize alignedBegin = begin - begin % m_nonCoherentAtomSize;
+  VkDeviceSize alignedEnd = std::min(alignUp(begin + size, m_nonCoherentAtomSize), block.size);
+
+  VkMappedMemoryRange range{};
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.memory = allocation.memory;
+  range.offset = alignedBegin;
+  range.size = alignedEnd == block.size ? VK_WHOLE_SIZE : alignedEnd - alignedBegin;
+
+  return range;
+}
+
+void DeviceAllocator::flush(const DeviceAllocation& allocation, VkDeviceSize offset,
+  VkDeviceSize size) {
+
+  if (isCoherent(allocation) || size == 0) {
+    return;
+  }
+
+  VkMappedMemoryRange range = mappedRange(allocation, offset, size);
+  VK_CHECK(vkFlushMappedMemoryRanges(m_device, 1, &range), "Failed to flush mapped memory");
+}
+
+void DeviceAllocator::invalidate(const DeviceAllocation& allocation, VkDeviceSize offset,
+  VkDeviceSize size) {
+
+  if (isCoherent(allocation) || size == 0) {
+    return;
+  }
+
+  VkMappedMemoryRange range = mappedRange(allocation, offset, size);
+  VK_CHECK(vkInvalidateMappedMemoryRanges(m_device, 1, &range),
+    "Failed to invalidate mapped memory");
+}
+
+DeviceAllocator::Block* DeviceAllocator::createBlock(uint32_t memoryType, VkDeviceSize size,
+  bool dedicated) {
+
+  ASSERT_MSG(m_allocationCount < m_maxAllocationCount,
+    "Exceeded device limit of " << m_maxAllocationCount << " memory allocations");
+
+  auto block = std::make_unique<Block>();
+  block->size = size;
+  block->dedicated = dedicated;
+  block->freeRanges.push_back(Range{ 0, size });
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryType;
+
+  VK_CHECK(vkAllocateMemory(m_device, &allocInfo, nullptr, &block->memory),
+    "Failed to allocate device memory block");
+
+  ++m_allocationCount;
+
+  VkMemoryPropertyFlags flags = m_memoryProperties.memoryTypes[memoryType].propertyFlags;
+  if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    void* data = nullptr;
+    VK_CHECK(vkMapMemory(m_device, block->memory, 0, VK_WHOLE_SIZE, 0, &data),
+      "Failed to map device memory block");
+    block->data = reinterpret_cast<char*>(data);
+  }
+
+  m_pools[memoryType].push_back(std::move(block));
+  return m_pools[memoryType].back().get();
+}
+
+void DeviceAllocator::destroyBlock(const Block& block) {
+  if (block.data != nullptr) {
+    vkUnmapMemory(m_device, block.memory);
+  }
+  vkFreeMemory(m_device, block.memory, nullptr);
+  --m_allocationCount;
+}
+
+bool DeviceAllocator::allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment,
+  VkDeviceSize& offset) {
+
+  for (size_t i = 0; i < block.freeRanges.size(); ++i) {
+    Range range = block.freeRanges[i];
+    VkDeviceSize alignedOffset = alignUp(range.offset, alignment);
+    VkDeviceSize padding = alignedOffset - range.offset;
+
+    if (padding + size > range.size) {
+      continue;
+    }
+
+    std::vector<Range> remaining;
+    if (padding > 0) {
+      remaining.push_back(Range{ range.offset, padding });
+    }
+    if (padding + size < range.size) {
+      remaining.push_back(Range{ alignedOffset + size, range.size - padding - size });
+    }
+
+    block.freeRanges.erase(block.freeRanges.begin() + i);
+    block.freeRanges.insert(block.freeRanges.begin() + i, remaining.begin(), remaining.end());
+    block.used += size;
+
+    offset = alignedOffset;
+    return true;
+  }
+
+  return false;
+}
+
+void DeviceAllocator::freeToBlock(Block& block, VkDeviceSize offset, VkDeviceSize size) {
+  auto& ranges = block.freeRanges;
+
+  auto next = std::lower_bound(ranges.begin(), ranges.end(), offset,
+    [](const Range& range, VkDeviceSize value) { return range.offset < value; });
+
+  auto i = ranges.insert(next, Range{ offset, size });
+
+  auto following = i + 1;
+  if (following != ranges.end() && i->offset + i->size == following->offset) {
+    i->size += following->size;
+    ranges.erase(following);
+  }
+
+  if (i != ranges.begin()) {
+    auto preceding = i - 1;
+    if (preceding->offset + preceding->size == i->offset) {
+      preceding->size += i->size;
+      ranges.erase(i);
+    }
+  }
+
+  block.used -= size;
+}
+
+DeviceAllocator::~DeviceAllocator() {
+  for (auto& pool : m_pools) {
+    for (auto& block : pool) {
+      destroyBlock(*block);
+    }
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <memory>
+#include <vector>
+
+struct DeviceAllocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  uint32_t memoryType = 0;
+  char* data = nullptr; // Non-null if the memory is host visible
+};
+
+// Suballocates buffers from large VkDeviceMemory blocks, with one pool of blocks per memory type.
+// Requests larger than half a block get a dedicated allocation.
+class DeviceAllocator {
+  public:
+    DeviceAllocator(VkPhysicalDevice physicalDevice, VkDevice device);
+
+    // Uses a memory type with the preferred properties as well, if there is one
+    DeviceAllocation allocate(const VkMemoryRequirements& requirements,
+      VkMemoryPropertyFlags properties, VkMemoryPropertyFlags preferredProperties = 0);
+    void free(const DeviceAllocation& allocation);
+
+    // Make host writes visible to the device and device writes visible to the host for a range
+    // of a mapped allocation. No-ops for host-coherent memory.
+    void flush(const DeviceAllocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+    void invalidate(const DeviceAllocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+
+    bool isCoherent(const DeviceAllocation& allocation) const;
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+    const VkPhysicalDeviceMemoryProperties& memoryProperties() const;
+
+    ~DeviceAllocator();
+
+  private:
+    struct Range {
+      VkDeviceSize offset;
+      VkDeviceSize size;
+    };
+
+    struct Block {
+      VkDeviceMemory memory = VK_NULL_HANDLE;
+      VkDeviceSize size = 0;
+      char* data = nullptr;
+      bool dedicated = false;
+      VkDeviceSize used = 0;
+      std::vector<Range> freeRanges; // Sorted by offset
+    };
+
+    using Pool = std::vector<std::unique_ptr<Block>>;
+
+    Block* createBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated);
+    void destroyBlock(const Block& block);
+    bool allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment,
+      VkDeviceSize& offset);
+    void freeToBlock(Block& block, VkDeviceSize offset, VkDeviceSize size);
+    VkDeviceSize preferredBlockSize(uint32_t memoryType) const;
+    bool tryFindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties,
+      uint32_t& memoryType) const;
+    const Block& findBlock(const DeviceAllocation& allocation) const;
+    VkMappedMemoryRange mappedRange(const DeviceAllocation& allocation, VkDeviceSize offset,
+      VkDeviceSize size) const;
+
+    VkDevice m_device;
+    VkPhysicalDeviceMemoryProperties m_memoryProperties;
+    uint32_t m_maxAllocationCount;
+    VkDeviceSize m_nonCoherentAtomSize;
+    uint32_t m_allocationCount = 0;
+    std::array<Pool, VK_MAX_MEMORY_TYPES> m_pools;
+};
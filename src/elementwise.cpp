@@ -0,0 +1,517 @@
+#include "elementwise.hpp"
+#include "cpu.hpp"
+#include "cache.hpp"
+#include "types.hpp"
+#include "exception.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace {
+
+const uint32_t WorkgroupSize = 128;
+// Push constants are guaranteed 128 bytes, of which the element count takes 4
+const size_t MaxParams = 31;
+// The guaranteed minimum of maxPerStageDescriptorStorageBuffers
+const size_t MaxBindings = 4;
+// Beyond this, the least recently used shader is destroyed
+const size_t MaxCachedShaders = 64;
+
+// A node of the graph, with arguments referring to earlier instructions
+struct Instruction {
+  ExprOp op;
+  uint32_t args[2];
+  float value;    // Of constants only, as params are passed at dispatch
+  uint32_t index; // Binding of loads, or index of params
+};
+
+struct Store {
+  uint32_t binding;
+  uint32_t instruction;
+};
+
+}
+
+// The graph in evaluation order, with buffers replaced by bindings, numbered in order of first
+// use. Everything but bindings and params is fixed by the graph's structure, and so by the shader.
+struct ElementwiseProgram {
+  std::vector<Instruction> instructions;
+  std::vector<Store> stores;
+  GpuBufferBindings bindings;
+  std::vector<bool> loaded;   // By binding
+  std::vector<bool> stored;   // By binding
+  std::vector<float> params;
+};
+
+namespace {
+
+using Program = ElementwiseProgram;
+
+class ProgramBuilder {
+  public:
+    Program build(const std::vector<ElementwiseOutput>& outputs);
+
+  private:
+    uint32_t visit(const ExprNode& node);
+    uint32_t binding(GpuBufferHandle buffer);
+
+    Program m_program;
+    std::map<const ExprNode*, uint32_t> m_visited;
+    std::map<GpuBufferHandle, uint32_t> m_bindings;
+};
+
+Program ProgramBuilder::build(const std::vector<ElementwiseOutput>& outputs) {
+  for (const ElementwiseOutput& output : outputs) {
+    uint32_t instruction = visit(*output.value.node());
+    uint32_t index = binding(output.buffer);
+
+    ASSERT_MSG(!m_program.stored[index], "Buffer " << output.buffer << " is written twice");
+    m_program.stored[index] = true;
+
+    m_program.stores.push_back({ index, instruction });
+  }
+
+  return std::move(m_program);
+}
+
+uint32_t ProgramBuilder::visit(const ExprNode& node) {
+  auto i = m_visited.find(&node);
+  if (i != m_visited.end()) {
+    return i->second;
+  }
+
+  float value = node.op == ExprOp::constant ? node.value : 0.f;
+  Instruction instruction{ node.op, { 0, 0 }, value, 0 };
+
+  ASSERT_MSG(node.args.size() <= 2, "Expression nodes take at most two arguments");
+  for (size_t arg = 0; arg < node.args.size(); ++arg) {
+    instruction.args[arg] = visit(*node.args[arg]);
+  }
+
+  if (node.op == ExprOp::load) {
+    instruction.index = binding(node.buffer);
+    m_program.loaded[instruction.index] = true;
+  }
+  else if (node.op == ExprOp::param) {
+    instruction.index = static_cast<uint32_t>(m_program.params.size());
+    m_program.params.push_back(node.value);
+  }
+
+  uint32_t index = static_cast<uint32_t>(m_program.instructions.size());
+  m_program.instructions.push_back(instruction);
+  m_visited[&node] = index;
+
+  return index;
+}
+
+uint32_t ProgramBuilder::binding(GpuBufferHandle buffer) {
+  auto i = m_bindings.find(buffer);
+  if (i != m_bindings.end()) {
+    return i->second;
+  }
+
+  uint32_t index = static_cast<uint32_t>(m_program.bindings.size());
+  m_program.bindings.push_back(buffer);
+  m_program.loaded.push_back(false);
+  m_program.stored.push_back(false);
+  m_bindings[buffer] = index;
+
+  return index;
+}
+
+template<typename T>
+uint64_t hashValue(const T& value, uint64_t hash) {
+  return hashBytes(&value, sizeof(value), hash);
+}
+
+// Of the parts of the program that the generated shader depends on
+uint64_t structuralHash(const Program& program) {
+  size_t size = program.instructions.size();
+  uint64_t hash = hashBytes(&size, sizeof(size));
+
+  for (const Instruction& instruction : program.instructions) {
+    hash = hashValue(instruction.op, hash);
+    hash = hashValue(instruction.args, hash);
+    hash = hashValue(instruction.value, hash);
+    hash = hashValue(instruction.index, hash);
+  }
+  for (const Store& store : program.stores) {
+    hash = hashValue(store.binding, hash);
+    hash = hashValue(store.instruction, hash);
+  }
+  for (size_t i = 0; i < program.loaded.size(); ++i) {
+    uint8_t access = program.loaded[i] | program.stored[i] << 1;
+    hash = hashValue(access, hash);
+  }
+
+  return hash;
+}
+
+// Whether two programs generate the same shader. Constants are compared bitwise, so that NaNs
+// match themselves.
+bool sameStructure(const Program& a, const Program& b) {
+  if (a.instructions.size() != b.instructions.size() || a.stores.size() != b.stores.size() ||
+    a.loaded != b.loaded || a.stored != b.stored) {
+
+    return false;
+  }
+
+  for (size_t i = 0; i < a.instructions.size(); ++i) {
+    const Instruction& x = a.instructions[i];
+    const Instruction& y = b.instructions[i];
+
+    if (x.op != y.op || x.args[0] != y.args[0] || x.args[1] != y.args[1] ||
+      x.index != y.index || memcmp(&x.value, &y.value, sizeof(float)) != 0) {
+
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < a.stores.size(); ++i) {
+    if (a.stores[i].binding != b.stores[i].binding ||
+      a.stores[i].instruction != b.stores[i].instruction) {
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Exact, as max_digits10 significant digits round trip
+std::string glslLiteral(float value) {
+  std::stringstream ss;
+  if (std::isfinite(value)) {
+    ss << std::scientific << std::setprecision(std::numeric_limits<float>::max_digits10 - 1)
+      << value;
+  }
+  else {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    ss << "uintBitsToFloat(0x" << std::hex << bits << "u)";
+  }
+  return ss.str();
+}
+
+std::string glslExpression(const Instruction& instruction) {
+  std::string a = "v" + std::to_string(instruction.args[0]);
+  std::string b = "v" + std::to_string(instruction.args[1]);
+
+  switch (instruction.op) {
+    case ExprOp::constant: return glslLiteral(instruction.value);
+    case ExprOp::param: return "constants.params[" + std::to_string(instruction.index) + "]";
+    case ExprOp::load: return "readBuffer" + std::to_string(instruction.index) + "(index)";
+    case ExprOp::add: return a + " + " + b;
+    case ExprOp::subtract: return a + " - " + b;
+    case ExprOp::multiply: return a + " * " + b;
+    case ExprOp::divide: return a + " / " + b;
+    case ExprOp::minimum: return "min(" + a + ", " + b + ")";
+    case ExprOp::maximum: return "max(" + a + ", " + b + ")";
+    case ExprOp::negate: return "-" + a;
+    case ExprOp::abs: return "abs(" + a + ")";
+    case ExprOp::exp: return "exp(" + a + ")";
+    case ExprOp::log: return "log(" + a + ")";
+    case ExprOp::sqrt: return "sqrt(" + a + ")";
+    case ExprOp::tanh: return "tanh(" + a + ")";
+  }
+
+  EXCEPTION("Unknown expression op " << static_cast<int>(instruction.op));
+}
+
+// One invocation per element, with each node of the graph a local variable
+std::string generateShader(const Program& program) {
+  std::stringstream ss;
+
+  ss << "#version 450\n\n#include \"utils.glsl\"\n\n";
+
+  ss << "layout(push_constant) uniform PushConstants {\n  uint count;\n";
+  if (!program.params.empty()) {
+    ss << "  float params[" << program.params.size() << "];\n";
+  }
+  ss << "} constants;\n";
+
+  for (size_t i = 0; i < program.bindings.size(); ++i) {
+    const char* qualifier = !program.stored[i] ? "readonly " :
+      !program.loaded[i] ? "NETFLOAT_WRITEONLY " : "";
+
+    ss << "\nlayout(std430, binding = " << i << ") " << qualifier << "buffer Buffer" << i
+      << "Ssbo {\n  NETFLOAT_PACK Buffer" << i << "[];\n};\n\n";
+
+    if (program.loaded[i]) {
+      ss << "FN_READ(Buffer" << i << ")\n";
+    }
+    if (program.stored[i]) {
+      ss << "FN_WRITE(Buffer" << i << ")\n";
+    }
+  }
+
+  ss << "\nvoid main() {\n"
+    << "  const uint index = gl_GlobalInvocationID.x;\n"
+    << "  if (index >= constants.count) {\n"
+    << "    return;\n"
+    << "  }\n\n";
+
+  for (size_t i = 0; i < program.instructions.size(); ++i) {
+    ss << "  float v" << i << " = " << glslExpression(program.instructions[i]) << ";\n";
+  }
+  for (const Store& store : program.stores) {
+    ss << "  writeBuffer" << store.binding << "(index, v" << store.instruction << ");\n";
+  }
+
+  ss << "}\n";
+
+  return ss.str();
+}
+
+template<typename F>
+void fill(float* out, size_t n, F&& fn) {
+  for (size_t j = 0; j < n; ++j) {
+    out[j] = fn(j);
+  }
+}
+
+// CPU equivalent of the generated shader. Evaluates one instruction at a time over the whole
+// range, so each loop is simple enough to vectorise.
+void evaluate(const Program& program, const CpuKernelArgs& args, uint32_t xBegin,
+  uint32_t xEnd) {
+
+  const char* constants = static_cast<const char*>(args.pushConstants);
+  size_t n = xEnd - xBegin;
+
+  std::vector<float> values(program.instructions.size() * n);
+
+  for (size_t i = 0; i < program.instructions.size(); ++i) {
+    const Instruction& instruction = program.instructions[i];
+    float* out = values.data() + i * n;
+    const float* a = values.data() + instruction.args[0] * n;
+    const float* b = values.data() + instruction.args[1] * n;
+
+    switch (instruction.op) {
+      case ExprOp::constant:
+        std::fill(out, out + n, instruction.value);
+        break;
+      case ExprOp::param: {
+        float value;
+        memcpy(&value, constants + sizeof(uint32_t) + instruction.index * sizeof(float),
+          sizeof(value));
+        std::fill(out, out + n, value);
+        break;
+      }
+      case ExprOp::load: {
+        const netfloat_t* data = static_cast<const netfloat_t*>(args.buffers[instruction.index]);
+        fill(out, n, [=](size_t j) { return static_cast<float>(data[xBegin + j]); });
+        break;
+      }
+      case ExprOp::add:
+        fill(out, n, [=](size_t j) { return a[j] + b[j]; });
+        break;
+      case ExprOp::subtract:
+        fill(out, n, [=](size_t j) { return a[j] - b[j]; });
+        break;
+      case ExprOp::multiply:
+        fill(out, n, [=](size_t j) { return a[j] * b[j]; });
+        break;
+      case ExprOp::divide:
+        fill(out, n, [=](size_t j) { return a[j] / b[j]; });
+        break;
+      case ExprOp::minimum:
+        fill(out, n, [=](size_t j) { return std::fmin(a[j], b[j]); });
+        break;
+      case ExprOp::maximum:
+        fill(out, n, [=](size_t j) { return std::fmax(a[j], b[j]); });
+        break;
+      case ExprOp::negate:
+        fill(out, n, [=](size_t j) { return -a[j]; });
+        break;
+      case ExprOp::abs:
+        fill(out, n, [=](size_t j) { return std::fabs(a[j]); });
+        break;
+      case ExprOp::exp:
+        fill(out, n, [=](size_t j) { return std::exp(a[j]); });
+        break;
+      case ExprOp::log:
+        fill(out, n, [=](size_t j) { return std::log(a[j]); });
+        break;
+      case ExprOp::sqrt:
+        fill(out, n, [=](size_t j) { return std::sqrt(a[j]); });
+        break;
+      case ExprOp::tanh:
+        fill(out, n, [=](size_t j) { return std::tanh(a[j]); });
+        break;
+    }
+  }
+
+  for (const Store& store : program.stores) {
+    netfloat_t* data = static_cast<netfloat_t*>(args.buffers[store.binding]);
+    const float* value = values.data() + store.instruction * n;
+    for (size_t j = 0; j < n; ++j) {
+      data[xBegin + j] = value[j];
+    }
+  }
+}
+
+Expr makeExpr(ExprOp op, std::vector<std::shared_ptr<const ExprNode>> args) {
+  auto node = std::make_shared<ExprNode>();
+  node->op = op;
+  node->args = std::move(args);
+  return Expr(std::move(node));
+}
+
+}
+
+Expr::Expr(float value) {
+  auto node = std::make_shared<ExprNode>();
+  node->op = ExprOp::constant;
+  node->value = value;
+  m_node = std::move(node);
+}
+
+Expr::Expr(std::shared_ptr<const ExprNode> node)
+  : m_node(std::move(node)) {
+
+  ASSERT_MSG(m_node != nullptr, "Expression node is null");
+}
+
+Expr Expr::load(GpuBufferHandle buffer) {
+  auto node = std::make_shared<ExprNode>();
+  node->op = ExprOp::load;
+  node->buffer = buffer;
+  return Expr(std::move(node));
+}
+
+Expr Expr::param(float value) {
+  auto node = std::make_shared<ExprNode>();
+  node->op = ExprOp::param;
+  node->value = value;
+  return Expr(std::move(node));
+}
+
+Expr operator+(const Expr& a, const Expr& b) {
+  return makeExpr(ExprOp::add, { a.node(), b.node() });
+}
+
+Expr operator-(const Expr& a, const Expr& b) {
+  return makeExpr(ExprOp::subtract, { a.node(), b.node() });
+}
+
+Expr operator*(const Expr& a, const Expr& b) {
+  return makeExpr(ExprOp::multiply, { a.node(), b.node() });
+}
+
+Expr operator/(const Expr& a, const Expr& b) {
+  return makeExpr(ExprOp::divide, { a.node(), b.node() });
+}
+
+Expr operator-(const Expr& a) {
+  return makeExpr(ExprOp::negate, { a.node() });
+}
+
+Expr min(const Expr& a, const Expr& b) {
+  return makeExpr(ExprOp::minimum, { a.node(), b.node() });
+}
+
+Expr max(const Expr& a, const Expr& b) {
+  return makeExpr(ExprOp::maximum, { a.node(), b.node() });
+}
+
+Expr abs(const Expr& a) {
+  return makeExpr(ExprOp::abs, { a.node() });
+}
+
+Expr exp(const Expr& a) {
+  return makeExpr(ExprOp::exp, { a.node() });
+}
+
+Expr log(const Expr& a) {
+  return makeExpr(ExprOp::log, { a.node() });
+}
+
+Expr sqrt(const Expr& a) {
+  return makeExpr(ExprOp::sqrt, { a.node() });
+}
+
+Expr tanh(const Expr& a) {
+  return makeExpr(ExprOp::tanh, { a.node() });
+}
+
+Elementwise::Elementwise(Gpu& gpu)
+  : m_gpu(gpu) {}
+
+void Elementwise::queue(const std::vector<ElementwiseOutput>& outputs, uint32_t count) {
+  if (count == 0 || outputs.empty()) {
+    return;
+  }
+
+  Program program = ProgramBuilder().build(outputs);
+
+  ASSERT_MSG(program.params.size() <= MaxParams, "Elementwise expressions can have at most "
+    << MaxParams << " params");
+  ASSERT_MSG(program.bindings.size() <= MaxBindings, "Elementwise expressions can use at most "
+    << MaxBindings << " buffers");
+
+  // Source is only generated on a miss
+  uint64_t key = structuralHash(program);
+
+  CachedShader* cached = nullptr;
+  auto range = m_shaders.equal_range(key);
+  for (auto i = range.first; i != range.second; ++i) {
+    if (sameStructure(*i->second.program, program)) {
+      cached = &i->second;
+      break;
+    }
+  }
+
+  if (cached == nullptr) {
+    cached = &compile(key, program);
+  }
+  cached->lastUse = ++m_useCount;
+
+  // Matches the push constant block of the generated shader
+  std::vector<uint32_t> constants(1 + program.params.size());
+  constants[0] = count;
+  if (!program.params.empty()) {
+    memcpy(constants.data() + 1, program.params.data(), program.params.size() * sizeof(float));
+  }
+
+  m_gpu.queueShaderWithBindings(cached->shader, program.bindings, { count, 1, 1 },
+    constants.data(), constants.size() * sizeof(uint32_t));
+}
+
+Elementwise::CachedShader& Elementwise::compile(uint64_t key, const ElementwiseProgram& program) {
+  if (m_shaders.size() >= MaxCachedShaders) {
+    auto oldest = std::min_element(m_shaders.begin(), m_shaders.end(),
+      [](const auto& a, const auto& b) { return a.second.lastUse < b.second.lastUse; });
+
+    m_gpu.destroyShader(oldest->second.shader);
+    m_shaders.erase(oldest);
+  }
+
+  auto shared = std::make_shared<const Program>(program);
+
+  // The path only names the shader and locates utils.glsl
+  std::stringstream path;
+  path << "shaders/elementwise_" << std::hex << key << ".glsl";
+
+  ShaderDesc desc;
+  desc.sourcePath = path.str();
+  desc.workgroupSize = { WorkgroupSize, 1, 1 };
+  desc.source = generateShader(program);
+  desc.cpuKernel = [shared](const CpuKernelArgs& args, uint32_t xBegin, uint32_t xEnd, uint32_t,
+    uint32_t) {
+
+    evaluate(*shared, args, xBegin, xEnd);
+  };
+
+  ShaderHandle shader = m_gpu.compileShaders({ desc })[0];
+
+  return m_shaders.insert({ key, CachedShader{ shader, shared, 0 } })->second;
+}
+
+Elementwise::~Elementwise() {
+  for (const auto& entry : m_shaders) {
+    m_gpu.destroyShader(entry.second.shader);
+  }
+}
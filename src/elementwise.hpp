@@ -0,0 +1,102 @@
+#pragma once
+
+#include "gpu.hpp"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class ExprOp {
+  constant,
+  param,
+  load,
+  add,
+  subtract,
+  multiply,
+  divide,
+  minimum,
+  maximum,
+  negate,
+  abs,
+  exp,
+  log,
+  sqrt,
+  tanh
+};
+
+struct ExprNode {
+  ExprOp op = ExprOp::constant;
+  float value = 0.f;            // For constants and params
+  GpuBufferHandle buffer = 0;   // For loads
+  std::vector<std::shared_ptr<const ExprNode>> args;
+};
+
+// A per-element expression over buffers of netfloat_t, evaluated in float. Copies share nodes,
+// so an Expr used several times is still computed once per element.
+class Expr {
+  public:
+    // A constant, compiled into the shader
+    Expr(float value);
+    explicit Expr(std::shared_ptr<const ExprNode> node);
+
+    // Element i of buffer, for each element i
+    static Expr load(GpuBufferHandle buffer);
+    // A scalar passed with each dispatch, so changing it doesn't generate another shader
+    static Expr param(float value);
+
+    const std::shared_ptr<const ExprNode>& node() const { return m_node; }
+
+  private:
+    std::shared_ptr<const ExprNode> m_node;
+};
+
+Expr operator+(const Expr& a, const Expr& b);
+Expr operator-(const Expr& a, const Expr& b);
+Expr operator*(const Expr& a, const Expr& b);
+Expr operator/(const Expr& a, const Expr& b);
+Expr operator-(const Expr& a);
+Expr min(const Expr& a, const Expr& b);
+Expr max(const Expr& a, const Expr& b);
+Expr abs(const Expr& a);
+Expr exp(const Expr& a);
+Expr log(const Expr& a);
+Expr sqrt(const Expr& a);
+Expr tanh(const Expr& a);
+
+struct ElementwiseProgram;
+
+struct ElementwiseOutput {
+  GpuBufferHandle buffer;
+  Expr value;
+};
+
+// Fuses chains of elementwise operations into one dispatch, so intermediate values stay in
+// registers rather than making a round trip through device memory. A GLSL shader is generated
+// for each distinct expression graph and compiled on first use, and the most recently used are
+// kept. Graphs differing only in the buffers they use or the values of their params share a
+// shader. Expressions can use up to 4 buffers and 31 params. Works on any Gpu, including the CPU
+// backend.
+class Elementwise {
+  public:
+    explicit Elementwise(Gpu& gpu);
+
+    // Queues a dispatch that evaluates every output's value for each element i < count, then
+    // writes them to element i of the outputs' buffers. Outputs may also be loaded, since each
+    // element is read before it's written, but each buffer can only be written by one output.
+    void queue(const std::vector<ElementwiseOutput>& outputs, uint32_t count);
+
+    ~Elementwise();
+
+  private:
+    struct CachedShader {
+      ShaderHandle shader;
+      std::shared_ptr<const ElementwiseProgram> program; // Tells apart colliding hashes
+      uint64_t lastUse;
+    };
+
+    CachedShader& compile(uint64_t key, const ElementwiseProgram& program);
+
+    Gpu& m_gpu;
+    std::multimap<uint64_t, CachedShader> m_shaders; // By structural hash
+    uint64_t m_useCount = 0;
+};
@@ -0,0 +1,106 @@
+#include "gemm.hpp"
+#include "cpu.hpp"
+#include "types.hpp"
+#include "exception.hpp"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const char* GemmShaderPath = "shaders/gemm.glsl";
+
+// Matches the push constant block of gemm.glsl
+struct GemmParams {
+  uint32_t M;
+  uint32_t N;
+  uint32_t K;
+  uint32_t transposeA;
+  uint32_t transposeB;
+  float alpha;
+  float beta;
+};
+
+// Computes row y of C, columns [xBegin, xEnd). Iterating k in the outer loop reads both A's row
+// and B's rows in order when they're untransposed.
+void gemmCpuKernel(const CpuKernelArgs& args, uint32_t xBegin, uint32_t xEnd, uint32_t y,
+  uint32_t) {
+
+  const GemmParams& params = *static_cast<const GemmParams*>(args.pushConstants);
+  const netfloat_t* A = static_cast<const netfloat_t*>(args.buffers[0]);
+  const netfloat_t* B = static_cast<const netfloat_t*>(args.buffers[1]);
+  netfloat_t* C = static_cast<netfloat_t*>(args.buffers[2]);
+
+  uint32_t end = std::min(xEnd, params.N);
+  if (y >= params.M || xBegin >= end) {
+    return;
+  }
+
+  std::vector<float> acc(end - xBegin, 0.f);
+
+  for (uint32_t k = 0; k < params.K; ++k) {
+    float a = params.transposeA ? A[k * params.M + y] : A[y * params.K + k];
+
+    if (params.transposeB) {
+      for (uint32_t n = xBegin; n < end; ++n) {
+        acc[n - xBegin] += a * B[n * params.K + k];
+      }
+    }
+    else {
+      const netfloat_t* row = B + k * params.N;
+      for (uint32_t n = xBegin; n < end; ++n) {
+        acc[n - xBegin] += a * row[n];
+      }
+    }
+  }
+
+  netfloat_t* row = C + y * params.N;
+  for (uint32_t n = xBegin; n < end; ++n) {
+    float value = params.alpha * acc[n - xBegin];
+    if (params.beta != 0.f) {
+      value += params.beta * row[n];
+    }
+    row[n] = value;
+  }
+}
+
+}
+
+Gemm::Gemm(Gpu& gpu, const GemmConfig& config)
+  : m_gpu(gpu),
+    m_config(config) {
+
+  ASSERT_MSG(config.threadM > 0 && config.tileM % config.threadM == 0,
+    "GEMM tileM must be a multiple of threadM");
+  ASSERT_MSG(config.threadN > 0 && config.tileN % config.threadN == 0,
+    "GEMM tileN must be a multiple of threadN");
+  ASSERT_MSG(config.tileK > 0, "GEMM tileK must be at least 1");
+
+  static std::once_flag registered;
+  std::call_once(registered, []() { registerCpuKernel(GemmShaderPath, gemmCpuKernel); });
+
+  ShaderDesc desc;
+  desc.sourcePath = GemmShaderPath;
+  desc.workgroupSize = { config.tileN / config.threadN, config.tileM / config.threadM, 1 };
+  desc.elementsPerInvocation = { config.threadN, config.threadM, 1 };
+  desc.specializationConstants = { config.tileM, config.tileN, config.tileK };
+
+  m_shader = gpu.compileShaders({ desc })[0];
+}
+
+void Gemm::queue(GpuBufferHandle A, GpuBufferHandle B, GpuBufferHandle C, uint32_t M,
+  uint32_t N, uint32_t K, bool transposeA, bool transposeB, float alpha, float beta) {
+
+  if (M == 0 || N == 0) {
+    return;
+  }
+
+  GemmParams params{ M, N, K, transposeA, transposeB, alpha, beta };
+
+  // Dispatched over C, with columns along x
+  m_gpu.queueShaderWithBindings(m_shader, { A, B, C }, { N, M, 1 }, &params, sizeof(params));
+}
+
+Gemm::~Gemm() {
+  m_gpu.destroyShader(m_shader);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "gpu.hpp"
+
+// Tile sizes of shaders/gemm.glsl. Each workgroup computes a tileM x tileN block of C with
+// (tileM / threadM) x (tileN / threadN) invocations, each accumulating threadM x threadN outputs
+// in registers.
+struct GemmConfig {
+  uint32_t tileM = 64;
+  uint32_t tileN = 64;
+  uint32_t tileK = 16;
+  uint32_t threadM = 4;
+  uint32_t threadN = 4;
+};
+
+// Matrix multiplication of netfloat_t matrices, stored densely in row-major order. Accumulation
+// is in float whatever the storage type. Works on any Gpu, including the CPU backend.
+class Gemm {
+  public:
+    Gemm(Gpu& gpu, const GemmConfig& config = GemmConfig{});
+
+    // Queues C = alpha op(A) op(B) + beta C, where op(A) is M x K and op(B) is K x N. op(X) is
+    // X transposed if the corresponding flag is set, so A is K x M in memory when transposeA is
+    // set. C is only read if beta is non-zero.
+    void queue(GpuBufferHandle A, GpuBufferHandle B, GpuBufferHandle C, uint32_t M, uint32_t N,
+      uint32_t K, bool transposeA = false, bool transposeB = false, float alpha = 1.f,
+      float beta = 0.f);
+
+    ~Gemm();
+
+  private:
+    Gpu& m_gpu;
+    GemmConfig m_config;
+    ShaderHandle m_shader;
+};
@@ -4,11 +4,18 @@
 #include <memory>
 #include <vector>
 #include <array>
+#include <map>
+#include <functional>
 
 using ShaderHandle = uint32_t;
 using GpuBufferHandle = uint32_t;
 using Size3 = const std::array<uint32_t, 3>;
 using GpuBufferBindings = std::vector<GpuBufferHandle>;
+using GpuSequenceHandle = uint32_t;
+
+// Identifies a batch of work submitted with flushQueueAsync(). Tickets increase monotonically and
+// 0 is never issued, so it always counts as complete.
+using GpuTicket = uint64_t;
 
 enum class GpuBufferFlags {
   frequentHostAccess  = 1 << 0,
@@ -32,19 +39,142 @@ constexpr bool operator!(GpuBufferFlags flag) {
 
 struct GpuBuffer {
   GpuBufferHandle handle = 0;
+  // Set when the buffer is mapped, including host-access buffers on devices that share memory
+  // with the host. Direct access isn't ordered against queued work, whereas submitBufferData()
+  // and retrieveBuffer() are, and reduce to memcpys on mapped buffers.
   void* data = nullptr;
 };
 
+// A byte range within a buffer
+struct GpuBufferRegion {
+  size_t offset = 0;
+  size_t size = 0;
+};
+
+// GPU execution times in microseconds
+struct GpuTimingStats {
+  size_t count = 0;
+  double min = 0;
+  double mean = 0;
+  double p99 = 0;
+};
+
+struct GpuProfile {
+  std::map<ShaderHandle, GpuTimingStats> shaders;
+  GpuTimingStats uploads;
+  GpuTimingStats downloads;
+};
+
+struct CpuKernelArgs;
+
+// Executes invocations x in [xBegin, xEnd) of row (y, z), where x counts elements of the problem
+// size regardless of the shader's elementsPerInvocation. Called concurrently on disjoint ranges,
+// so the loop over x is the place to vectorise. There are no workgroups, so kernels can't share
+// memory or synchronise between invocations. See cpu.hpp.
+using CpuKernel = std::function<void(const CpuKernelArgs& args, uint32_t xBegin, uint32_t xEnd,
+  uint32_t y, uint32_t z)>;
+
+struct ShaderDesc {
+  std::string sourcePath;
+  GpuBufferBindings bufferBindings;
+  std::array<uint32_t, 3> workgroupSize{ 1, 1, 1 };
+  // Elements handled by each invocation in each dimension, e.g. 4 along x for shaders using the
+  // FN_*4 functions in utils.glsl. Problem sizes stay in elements and are divided by this to
+  // size dispatches.
+  std::array<uint32_t, 3> elementsPerInvocation{ 1, 1, 1 };
+  // Values of specialization constants with ids 3 onwards, ids 0 to 2 being the workgroup size
+  std::vector<uint32_t> specializationConstants{};
+  // GLSL to compile in place of the file at sourcePath, e.g. for generated shaders. sourcePath
+  // still names the shader and locates its includes, but needn't exist.
+  std::string source{};
+  // Used by the CPU backend in place of the kernel registered for sourcePath, e.g. for generated
+  // shaders. Ignored by other backends.
+  CpuKernel cpuKernel{};
+};
+
 class Gpu {
   public:
     virtual GpuBuffer allocateBuffer(size_t size, GpuBufferFlags flags) = 0;
+    // The handle becomes invalid immediately, but the memory is only reclaimed once queued and
+    // in-flight work using the buffer completes. Shaders bound to the buffer mustn't be queued
+    // again.
+    virtual void freeBuffer(GpuBufferHandle buffer) = 0;
+    // workgroupSize is clamped to the device's limits. bufferBindings, indexed by binding number,
+    // are the defaults used by queueShader() and may be left empty if the shader is only queued
+    // with queueShaderWithBindings().
     virtual ShaderHandle compileShader(const std::string& sourcePath,
       const GpuBufferBindings& bufferBindings, const Size3& workgroupSize) = 0;
+    // Compiles the shaders in parallel, returning their handles in the same order. Prefer this
+    // over repeated compileShader() calls when loading many shaders at once.
+    virtual std::vector<ShaderHandle> compileShaders(const std::vector<ShaderDesc>& shaders) = 0;
+    // As with freeBuffer(), destruction is deferred until work using the shader completes.
+    // Sequences that use the shader mustn't be queued again.
+    virtual void destroyShader(ShaderHandle shader) = 0;
+    // The data is copied before returning, but the upload itself is queued with other work
     virtual void submitBufferData(GpuBufferHandle buffer, const void* data) = 0;
-    virtual void queueShader(ShaderHandle shaderHandle) = 0;
+    // Writes size bytes from data to the buffer at offset
+    virtual void submitBufferData(GpuBufferHandle buffer, const void* data, size_t offset,
+      size_t size) = 0;
+    // Uploads several regions with a single copy command. data mirrors the whole buffer, so each
+    // region is read from the same offset in data as it's written to in the buffer.
+    virtual void submitBufferRegions(GpuBufferHandle buffer, const void* data,
+      const std::vector<GpuBufferRegion>& regions) = 0;
+    // Dispatches enough workgroups to cover problemSize invocations. Shaders must ignore
+    // invocations beyond the end of their data. pushConstants must match the size of the
+    // shader's push_constant block, if it has one, and are recorded into the command stream.
+    virtual void queueShader(ShaderHandle shaderHandle, const Size3& problemSize,
+      const void* pushConstants = nullptr, size_t pushConstantsSize = 0) = 0;
+    // As queueShader(), but runs the shader on the given buffers instead of its defaults. The
+    // buffers must match the types the shader declares. Descriptor sets are cached per set of
+    // bindings, so rebinding is cheap after the first use.
+    virtual void queueShaderWithBindings(ShaderHandle shaderHandle,
+      const GpuBufferBindings& bufferBindings, const Size3& problemSize,
+      const void* pushConstants = nullptr, size_t pushConstantsSize = 0) = 0;
+    // Runs the shader with a range of workgroup sizes and rebuilds it with the fastest. The
+    // result is cached per shader, device and problem size across runs. Since the shader is
+    // executed, it should be safe to run repeatedly on its current bindings.
+    virtual std::array<uint32_t, 3> tuneWorkgroupSize(ShaderHandle shaderHandle,
+      const Size3& problemSize, const void* pushConstants = nullptr,
+      size_t pushConstantsSize = 0) = 0;
     virtual void retrieveBuffer(GpuBufferHandle buffer, void* data) = 0;
+    // Reads size bytes from the buffer at offset into data
+    virtual void retrieveBuffer(GpuBufferHandle buffer, void* data, size_t offset,
+      size_t size) = 0;
+    // Downloads several regions with a single copy command. As with submitBufferRegions(), data
+    // mirrors the whole buffer and only the given regions of it are written.
+    virtual void retrieveBufferRegions(GpuBufferHandle buffer, void* data,
+      const std::vector<GpuBufferRegion>& regions) = 0;
+    // Queues a read of size bytes from the buffer at offset without waiting for it. The read
+    // sees the buffer as of its place in the queue, unaffected by work queued after it. data is
+    // written by the time the ticket of the flush that submits the read completes, and must stay
+    // valid until then.
+    virtual void retrieveBufferAsync(GpuBufferHandle buffer, void* data, size_t offset,
+      size_t size) = 0;
     virtual void flushQueue() = 0;
 
+    // Submits all queued work without waiting for it to finish. Several submissions may be in
+    // flight at once.
+    virtual GpuTicket flushQueueAsync() = 0;
+    virtual bool isComplete(GpuTicket ticket) = 0;
+    virtual void wait(GpuTicket ticket) = 0;
+    // Runs callback on the calling thread of a later isComplete(), wait() or flush once the
+    // ticket's work has finished, or immediately if it already has
+    virtual void onComplete(GpuTicket ticket, std::function<void()> callback) = 0;
+
+    // Shaders queued between beginSequence() and endSequence() are recorded once into a reusable
+    // sequence rather than the queue. queueSequence() then queues that work again without
+    // re-recording it.
+    virtual void beginSequence() = 0;
+    virtual GpuSequenceHandle endSequence() = 0;
+    virtual void queueSequence(GpuSequenceHandle sequence) = 0;
+
+    // While enabled, each dispatch and staging copy queued is timed on the GPU. Work recorded into
+    // sequences isn't timed. Timings are collected as submissions complete, so profile() only
+    // covers work that has finished.
+    virtual void setProfilingEnabled(bool enabled) = 0;
+    virtual GpuProfile profile() = 0;
+    virtual void resetProfile() = 0;
+
     virtual ~Gpu() = default;
 };
 
@@ -0,0 +1,141 @@
+#include "gpu_stream.hpp"
+#include "exception.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Owns a file descriptor and its mapping
+class MappedFile {
+  public:
+    MappedFile(const std::string& path, size_t size, bool writable)
+      : m_size(size) {
+
+      m_fd = open(path.c_str(), writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+      ASSERT_MSG(m_fd != -1, "Failed to open " << path << ": " << strerror(errno));
+
+      if (writable && ftruncate(m_fd, size) != 0) {
+        close(m_fd);
+        EXCEPTION("Failed to resize " << path << ": " << strerror(errno));
+      }
+
+      if (size == 0) {
+        return;
+      }
+
+      int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+      m_data = mmap(nullptr, size, protection, MAP_SHARED, m_fd, 0);
+      if (m_data == MAP_FAILED) {
+        close(m_fd);
+        EXCEPTION("Failed to map " << path << ": " << strerror(errno));
+      }
+
+      // Chunks are read and written in order
+      madvise(m_data, size, MADV_SEQUENTIAL);
+    }
+
+    void* data() const {
+      return m_data;
+    }
+
+    ~MappedFile() {
+      if (m_data != nullptr) {
+        munmap(m_data, m_size);
+      }
+      close(m_fd);
+    }
+
+  private:
+    int m_fd = -1;
+    void* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+size_t fileSize(const std::string& path) {
+  struct stat info;
+  ASSERT_MSG(stat(path.c_str(), &info) == 0, "Failed to stat " << path << ": "
+    << strerror(errno));
+
+  return info.st_size;
+}
+
+}
+
+GpuStream::GpuStream(Gpu& gpu, const GpuStreamDesc& desc)
+  : m_gpu(gpu),
+    m_desc(desc) {
+
+  ASSERT_MSG(desc.depth > 0, "Stream depth must be at least 1");
+  ASSERT_MSG(desc.chunkElements > 0, "Stream chunks must hold at least 1 element");
+
+  for (size_t i = 0; i < desc.depth; ++i) {
+    Slot slot;
+    slot.input = gpu.allocateBuffer(desc.chunkElements * desc.inputElementSize,
+      GpuBufferFlags::large | GpuBufferFlags::hostWriteAccess).handle;
+    slot.output = gpu.allocateBuffer(desc.chunkElements * desc.outputElementSize,
+      GpuBufferFlags::large | GpuBufferFlags::hostReadAccess).handle;
+
+    m_slots.push_back(slot);
+  }
+}
+
+void GpuStream::process(const void* input, void* output, size_t count,
+  const void* pushConstants, size_t pushConstantsSize) {
+
+  const char* src = static_cast<const char*>(input);
+  char* dst = static_cast<char*>(output);
+
+  size_t chunks = (count + m_desc.chunkElements - 1) / m_desc.chunkElements;
+
+  for (size_t i = 0; i < chunks; ++i) {
+    Slot& slot = m_slots[i % m_slots.size()];
+
+    // Bounds the work in flight, and with it the staging memory held
+    m_gpu.wait(slot.ticket);
+
+    size_t first = i * m_desc.chunkElements;
+    size_t elements = std::min(m_desc.chunkElements, count - first);
+
+    m_gpu.submitBufferData(slot.input, src + first * m_desc.inputElementSize, 0,
+      elements * m_desc.inputElementSize);
+
+    m_gpu.queueShaderWithBindings(m_desc.shader, { slot.input, slot.output },
+      { static_cast<uint32_t>(elements), 1, 1 }, pushConstants, pushConstantsSize);
+
+    m_gpu.retrieveBufferAsync(slot.output, dst + first * m_desc.outputElementSize, 0,
+      elements * m_desc.outputElementSize);
+
+    slot.ticket = m_gpu.flushQueueAsync();
+  }
+
+  for (Slot& slot : m_slots) {
+    m_gpu.wait(slot.ticket);
+  }
+}
+
+void GpuStream::processFile(const std::string& inputPath, const std::string& outputPath,
+  const void* pushConstants, size_t pushConstantsSize) {
+
+  size_t inputSize = fileSize(inputPath);
+  ASSERT_MSG(inputSize % m_desc.inputElementSize == 0, inputPath << " isn't a whole number of "
+    << m_desc.inputElementSize << " byte elements");
+
+  size_t count = inputSize / m_desc.inputElementSize;
+
+  MappedFile input(inputPath, inputSize, false);
+  MappedFile output(outputPath, count * m_desc.outputElementSize, true);
+
+  process(input.data(), output.data(), count, pushConstants, pushConstantsSize);
+}
+
+GpuStream::~GpuStream() {
+  for (const Slot& slot : m_slots) {
+    m_gpu.freeBuffer(slot.input);
+    m_gpu.freeBuffer(slot.output);
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "types.hpp"
+#include <string>
+#include <vector>
+
+struct GpuStreamDesc {
+  // Bound to { input chunk, output chunk } and queued with a problem size of the chunk's
+  // element count
+  ShaderHandle shader = 0;
+  size_t inputElementSize = sizeof(netfloat_t);
+  size_t outputElementSize = sizeof(netfloat_t);
+  size_t chunkElements = 1024 * 1024;
+  // Chunks in flight at once. 2 double buffers and 3 triple buffers.
+  size_t depth = 3;
+};
+
+// Runs a shader over data too large for device memory by passing it through a ring of chunk
+// buffers. While one chunk computes, the next is uploading and the previous downloading, on
+// separate queues where the device has them.
+class GpuStream {
+  public:
+    GpuStream(Gpu& gpu, const GpuStreamDesc& desc);
+
+    // Processes count elements from input into output and waits for the results. The push
+    // constants, if any, are the same for every chunk.
+    void process(const void* input, void* output, size_t count,
+      const void* pushConstants = nullptr, size_t pushConstantsSize = 0);
+    // As process(), with the input and output files memory-mapped. The output file is created
+    // or truncated to fit.
+    void processFile(const std::string& inputPath, const std::string& outputPath,
+      const void* pushConstants = nullptr, size_t pushConstantsSize = 0);
+
+    ~GpuStream();
+
+  private:
+    struct Slot {
+      GpuBufferHandle input = 0;
+      GpuBufferHandle output = 0;
+      GpuTicket ticket = 0; // Of the chunk last using the slot
+    };
+
+    Gpu& m_gpu;
+    GpuStreamDesc m_desc;
+    std::vector<Slot> m_slots;
+};
@@ -0,0 +1,144 @@
+#include "hazard_tracker.hpp"
+#include <algorithm>
+
+namespace {
+
+const VkAccessFlags WriteAccessMask = VK_ACCESS_SHADER_WRITE_BIT
+                                    | VK_ACCESS_TRANSFER_WRITE_BIT
+                                    | VK_ACCESS_HOST_WRITE_BIT
+                                    | VK_ACCESS_MEMORY_WRITE_BIT;
+
+// Merges accesses to the same buffer so each buffer needs at most one barrier
+std::vector<BufferAccess> coalesce(const std::vector<BufferAccess>& accesses) {
+  std::vector<BufferAccess> merged;
+
+  for (const BufferAccess& access : accesses) {
+    auto i = std::find_if(merged.begin(), merged.end(),
+      [&](const BufferAccess& a) { return a.buffer == access.buffer; });
+
+    if (i == merged.end()) {
+      merged.push_back(access);
+    }
+    else {
+      i->stage |= access.stage;
+      i->access |= access.access;
+      i->write = i->write || access.write;
+      i->hostVisible = i->hostVisible || access.hostVisible;
+    }
+  }
+
+  return merged;
+}
+
+}
+
+void HazardTracker::recordBarriers(VkCommandBuffer commandBuffer,
+  const std::vector<BufferAccess>& accesses) {
+
+  VkPipelineStageFlags srcStages = 0;
+  VkPipelineStageFlags dstStages = 0;
+  std::vector<VkBufferMemoryBarrier> barriers;
+
+  for (const BufferAccess& access : coalesce(accesses)) {
+    BufferState& state = m_states[access.buffer];
+    state.hostVisible = state.hostVisible || access.hostVisible;
+
+    bool pendingWrite = state.writeStages != 0;
+    bool notYetVisible = (access.stage & ~state.visibleStages) != 0
+      || (access.access & ~state.visibleAccess) != 0;
+
+    bool memoryHazard = pendingWrite && (access.write || notYetVisible);
+    bool executionHazard = access.write && state.readStages != 0;
+
+    if (memoryHazard) {
+      VkBufferMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      barrier.srcAccessMask = state.writeAccess;
+      barrier.dstAccessMask = access.access;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.buffer = access.buffer;
+      barrier.offset = 0;
+      barrier.size = VK_WHOLE_SIZE;
+
+      barriers.push_back(barrier);
+      srcStages |= state.writeStages;
+      dstStages |= access.stage;
+    }
+
+    if (executionHazard) {
+      srcStages |= state.readStages;
+      dstStages |= access.stage;
+    }
+
+    if (access.write) {
+      state.writeStages = access.stage;
+      state.writeAccess = access.access & WriteAccessMask;
+      state.visibleStages = 0;
+      state.visibleAccess = 0;
+      state.readStages = 0;
+    }
+    else {
+      if (memoryHazard) {
+        state.visibleStages |= access.stage;
+        state.visibleAccess |= access.access;
+      }
+      state.readStages |= access.stage;
+    }
+  }
+
+  if (srcStages != 0) {
+    vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr, barriers.size(),
+      barriers.data(), 0, nullptr);
+  }
+}
+
+void HazardTracker::recordHostBarrier(VkCommandBuffer commandBuffer) {
+  VkPipelineStageFlags srcStages = 0;
+  VkAccessFlags srcAccess = 0;
+
+  for (auto& entry : m_states) {
+    BufferState& state = entry.second;
+
+    if (state.hostVisible && state.writeStages != 0 &&
+      !(state.visibleStages & VK_PIPELINE_STAGE_HOST_BIT)) {
+
+      srcStages |= state.writeStages;
+      srcAccess |= state.writeAccess;
+      state.visibleStages |= VK_PIPELINE_STAGE_HOST_BIT;
+      state.visibleAccess |= VK_ACCESS_HOST_READ_BIT;
+    }
+  }
+
+  if (srcStages == 0) {
+    return;
+  }
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer, srcStages, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0,
+    nullptr, 0, nullptr);
+}
+
+void HazardTracker::recordFullBarrier(VkCommandBuffer commandBuffer) {
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+                        | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT
+                        | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+  VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                              | VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer, stages, stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  m_states.clear();
+}
+
+void HazardTracker::forget(VkBuffer buffer) {
+  m_states.erase(buffer);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <unordered_map>
+#include <vector>
+
+struct BufferAccess {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkPipelineStageFlags stage = 0;
+  VkAccessFlags access = 0;
+  bool write = false;
+  bool hostVisible = false;
+};
+
+// Tracks outstanding reads and writes per buffer within a command stream and records the minimal
+// pipeline barriers needed to order dependent commands. Commands with no shared buffers or only
+// shared reads are left free to overlap.
+class HazardTracker {
+  public:
+    // Call before recording a command that performs the given accesses
+    void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<BufferAccess>& accesses);
+    // Makes outstanding writes to host-visible buffers visible to the host
+    void recordHostBarrier(VkCommandBuffer commandBuffer);
+    // Orders everything recorded earlier in submission order against everything that follows,
+    // for when the state of the stream isn't known
+    void recordFullBarrier(VkCommandBuffer commandBuffer);
+    // Drops state for a destroyed buffer, whose handle may be reused
+    void forget(VkBuffer buffer);
+
+  private:
+    struct BufferState {
+      VkPipelineStageFlags writeStages = 0;
+      VkAccessFlags writeAccess = 0;
+      VkPipelineStageFlags visibleStages = 0;
+      VkAccessFlags visibleAccess = 0;
+      VkPipelineStageFlags readStages = 0;
+      bool hostVisible = false;
+    };
+
+    std::unordered_map<VkBuffer, BufferState> m_states;
+};
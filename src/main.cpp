@@ -1,7 +1,12 @@
 #include "gpu.hpp"
+#include "cpu.hpp"
+#include "reduction.hpp"
+#include "elementwise.hpp"
 #include "types.hpp"
 #include "exception.hpp"
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 
@@ -13,77 +18,99 @@ void printBuffer(const std::array<netfloat_t, N>& buffer) {
   std::cout << std::endl;
 }
 
-struct Ubo {
+void printTimings(const std::string& name, const GpuTimingStats& stats) {
+  std::cout << name << ": " << stats.count << " runs, min " << stats.min << " us, mean "
+    << stats.mean << " us, p99 " << stats.p99 << " us" << std::endl;
+}
+
+struct Params {
   float a[2];
   float b[2];
 };
 
-void computeExpectedOutput() {
-  std::array<netfloat_t, 16> A{ 1, 2, 3, 4, 5, 6, 7, 8, 1, 2, 3, 4, 5, 6, 7, 8 };
-  std::array<netfloat_t, 16> B{};
+using Buffer = std::array<netfloat_t, 16>;
 
-  constexpr size_t iterations = 3;
-  for (size_t i = 0; i < iterations; ++i) {
-    Ubo ubo{{ i + 0.f, i + 1.f }, { i + 2.f, i + 3.f }};
+// The shaders access whole vec4s, so buffers must hold a multiple of four elements, as the
+// Vulkan backend checks when binding them
+void checkVec4Buffers(const CpuKernelArgs& args) {
+  for (size_t size : args.bufferSizes) {
+    ASSERT_MSG(size % (4 * sizeof(netfloat_t)) == 0, "Buffer of " << size
+      << " bytes isn't a whole number of vec4s");
+  }
+}
 
-    for (size_t j = 0; j < A.size(); ++j) {
-      B[j] = A[j] * 2.f + ubo.a[0] + ubo.a[1] + ubo.b[0] + ubo.b[1];
-    }
+// CPU equivalents of the shaders, used to check the GPU's results
+void registerKernels() {
+  registerCpuKernel("shaders/shader.glsl", [](const CpuKernelArgs& args, uint32_t xBegin,
+    uint32_t xEnd, uint32_t, uint32_t) {
 
-    for (size_t j = 0; j < A.size(); ++j) {
-      A[j] = B[j] * 3.f;
-    }
-  }
+    checkVec4Buffers(args);
 
-  printBuffer(A);
-  printBuffer(B);
-}
+    const Params& params = *static_cast<const Params*>(args.pushConstants);
+    const netfloat_t* A = static_cast<const netfloat_t*>(args.buffers[0]);
+    netfloat_t* B = static_cast<netfloat_t*>(args.buffers[1]);
 
-int main() {
-  GpuPtr gpu = createGpu();
+    uint32_t end = std::min<uint32_t>(xEnd, args.bufferSizes[1] / sizeof(netfloat_t));
+    float sum = params.a[0] + params.a[1] + params.b[0] + params.b[1];
+    for (uint32_t i = xBegin; i < end; ++i) {
+      B[i] = A[i] * 2.f + sum;
+    }
+  });
 
-  std::array<netfloat_t, 16> bufferAData{
-    1, 2, 3, 4, 5, 6, 7, 8, 1, 2, 3, 4, 5, 6, 7, 8
-  };
+  registerCpuKernel("shaders/shader2.glsl", [](const CpuKernelArgs& args, uint32_t xBegin,
+    uint32_t xEnd, uint32_t, uint32_t) {
 
-  std::array<netfloat_t, 16> bufferBData{};
+    checkVec4Buffers(args);
 
-  GpuBuffer ubo = gpu->allocateBuffer(sizeof(Ubo),
-    GpuBufferFlags::frequentHostAccess | GpuBufferFlags::shaderReadonly);
+    const netfloat_t* B = static_cast<const netfloat_t*>(args.buffers[0]);
+    netfloat_t* A = static_cast<netfloat_t*>(args.buffers[1]);
 
-  ASSERT_MSG(ubo.data != nullptr, "Expected ubo to be memory mapped");
+    uint32_t end = std::min<uint32_t>(xEnd, args.bufferSizes[1] / sizeof(netfloat_t));
+    for (uint32_t i = xBegin; i < end; ++i) {
+      A[i] = B[i] * 3.f;
+    }
+  });
+}
 
-  GpuBuffer bufferA = gpu->allocateBuffer(bufferAData.size() * sizeof(netfloat_t),
+void run(Gpu& gpu, Buffer& bufferAData, Buffer& bufferBData) {
+  GpuBuffer bufferA = gpu.allocateBuffer(bufferAData.size() * sizeof(netfloat_t),
     GpuBufferFlags::large | GpuBufferFlags::hostReadAccess | GpuBufferFlags::hostWriteAccess);
 
-  GpuBuffer bufferB = gpu->allocateBuffer(bufferBData.size() * sizeof(netfloat_t),
+  GpuBuffer bufferB = gpu.allocateBuffer(bufferBData.size() * sizeof(netfloat_t),
     GpuBufferFlags::large | GpuBufferFlags::hostReadAccess);
 
-  uint32_t gpuThreads = static_cast<uint32_t>(bufferAData.size());
+  uint32_t problemSize = static_cast<uint32_t>(bufferAData.size());
 
-  ShaderHandle shader1 = gpu->compileShader("shaders/shader.glsl",
-    { ubo.handle, bufferA.handle, bufferB.handle }, { gpuThreads, 1, 1 });
+  // Both shaders process four elements per invocation
+  std::vector<ShaderHandle> shaders = gpu.compileShaders({
+    { "shaders/shader.glsl", {}, { 64, 1, 1 }, { 4, 1, 1 } },
+    { "shaders/shader2.glsl", {}, { 64, 1, 1 }, { 4, 1, 1 } }
+  });
 
-  ShaderHandle shader2 = gpu->compileShader("shaders/shader2.glsl",
-    { bufferB.handle, bufferA.handle }, { gpuThreads, 1, 1 });
+  ShaderHandle shader1 = shaders[0];
+  ShaderHandle shader2 = shaders[1];
+
+  gpu.setProfilingEnabled(true);
 
   auto startTime = std::chrono::high_resolution_clock::now();
 
-  gpu->submitBufferData(bufferA.handle, bufferAData.data());
+  gpu.submitBufferData(bufferA.handle, bufferAData.data());
 
+  // Parameters travel in the command stream, so every iteration can be queued up front
   constexpr size_t iterations = 3;
   for (size_t i = 0; i < iterations; ++i) {
-    Ubo& uboData = *reinterpret_cast<Ubo*>(ubo.data);
-    uboData = Ubo{{ i + 0.f, i + 1.f }, { i + 2.f, i + 3.f }};
-
-    gpu->queueShader(shader1);
-    gpu->queueShader(shader2);
+    Params params{{ i + 0.f, i + 1.f }, { i + 2.f, i + 3.f }};
 
-    gpu->flushQueue();
+    gpu.queueShaderWithBindings(shader1, { bufferA.handle, bufferB.handle },
+      { problemSize, 1, 1 }, &params, sizeof(params));
+    gpu.queueShaderWithBindings(shader2, { bufferB.handle, bufferA.handle },
+      { problemSize, 1, 1 });
   }
 
-  gpu->retrieveBuffer(bufferA.handle, bufferAData.data());
-  gpu->retrieveBuffer(bufferB.handle, bufferBData.data());
+  gpu.flushQueue();
+
+  gpu.retrieveBuffer(bufferA.handle, bufferAData.data());
+  gpu.retrieveBuffer(bufferB.handle, bufferBData.data());
 
   auto endTime = std::chrono::high_resolution_clock::now();
   auto time = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
@@ -91,9 +118,138 @@ int main() {
   printBuffer(bufferAData);
   printBuffer(bufferBData);
 
+  // Reduced on the device, so only the result is read back
+  Reduction reduction(gpu);
+  ReductionResult sum = reduction.reduce(ReduceOp::sum, bufferB.handle, problemSize);
+  ReductionResult largest = reduction.reduce(ReduceOp::argmax, bufferB.handle, problemSize);
+  std::cout << "Sum of B: " << sum.value << ", largest " << largest.value << " at "
+    << largest.index << std::endl;
+
   std::cout << "Time elapsed: " << time << " microseconds" << std::endl;
 
-  computeExpectedOutput();
+  GpuProfile profile = gpu.profile();
+  printTimings("shader.glsl", profile.shaders[shader1]);
+  printTimings("shader2.glsl", profile.shaders[shader2]);
+  printTimings("Uploads", profile.uploads);
+  printTimings("Downloads", profile.downloads);
+}
+
+// The same iterations with both shaders fused into one dispatch, so B is only ever written
+void runFused(Gpu& gpu, Buffer& bufferAData, Buffer& bufferBData) {
+  GpuBuffer bufferA = gpu.allocateBuffer(bufferAData.size() * sizeof(netfloat_t),
+    GpuBufferFlags::large | GpuBufferFlags::hostReadAccess | GpuBufferFlags::hostWriteAccess);
+
+  GpuBuffer bufferB = gpu.allocateBuffer(bufferBData.size() * sizeof(netfloat_t),
+    GpuBufferFlags::large | GpuBufferFlags::hostReadAccess);
+
+  uint32_t problemSize = static_cast<uint32_t>(bufferAData.size());
+
+  gpu.submitBufferData(bufferA.handle, bufferAData.data());
+
+  // Each iteration has the same graph, so the generated shader is compiled once
+  Elementwise elementwise(gpu);
+  constexpr size_t iterations = 3;
+  for (size_t i = 0; i < iterations; ++i) {
+    Params params{{ i + 0.f, i + 1.f }, { i + 2.f, i + 3.f }};
+    float sum = params.a[0] + params.a[1] + params.b[0] + params.b[1];
+
+    Expr B = Expr::load(bufferA.handle) * 2.f + Expr::param(sum);
+    elementwise.queue({ { bufferB.handle, B }, { bufferA.handle, B * 3.f } }, problemSize);
+  }
+
+  gpu.flushQueue();
+
+  gpu.retrieveBuffer(bufferA.handle, bufferAData.data());
+  gpu.retrieveBuffer(bufferB.handle, bufferBData.data());
+
+  printBuffer(bufferAData);
+  printBuffer(bufferBData);
+
+  gpu.freeBuffer(bufferA.handle);
+  gpu.freeBuffer(bufferB.handle);
+}
+
+// Async reads return the contents as of their place in the queue, whatever is queued after them,
+// including for buffers the host can map
+bool checkAsyncRetrieval(Gpu& gpu) {
+  const uint32_t count = 1024;
+  const size_t size = count * sizeof(netfloat_t);
+
+  GpuBuffer buffer = gpu.allocateBuffer(size, GpuBufferFlags::frequentHostAccess
+    | GpuBufferFlags::hostReadAccess | GpuBufferFlags::hostWriteAccess);
+
+  ShaderHandle increment = gpu.compileShader("shaders/bench_increment.glsl", { buffer.handle },
+    { 64, 1, 1 });
+
+  std::vector<netfloat_t> data(count, 1.f);
+  gpu.submitBufferData(buffer.handle, data.data());
+
+  // One read behind work in flight, then one with more work queued after it in the same batch
+  std::vector<netfloat_t> inFlight(count);
+  std::vector<netfloat_t> queued(count);
+
+  gpu.queueShader(increment, { count, 1, 1 });
+  gpu.flushQueueAsync();
+  gpu.retrieveBufferAsync(buffer.handle, inFlight.data(), 0, size);
+  gpu.queueShader(increment, { count, 1, 1 });
+  gpu.retrieveBufferAsync(buffer.handle, queued.data(), 0, size);
+  gpu.queueShader(increment, { count, 1, 1 });
+  gpu.flushQueue();
+
+  gpu.destroyShader(increment);
+  gpu.freeBuffer(buffer.handle);
+
+  for (uint32_t i = 0; i < count; ++i) {
+    if (inFlight[i] != 2.f || queued[i] != 3.f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool matches(const Buffer& actual, const Buffer& expected) {
+  for (size_t i = 0; i < actual.size(); ++i) {
+    if (std::abs(actual[i] - expected[i]) > 1e-4f * std::max(1.f, std::abs(expected[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  registerKernels();
+
+  const Buffer input{ 1, 2, 3, 4, 5, 6, 7, 8, 1, 2, 3, 4, 5, 6, 7, 8 };
+
+  Buffer gpuA = input;
+  Buffer gpuB{};
+  std::cout << "GPU" << std::endl;
+  run(*createGpu(), gpuA, gpuB);
+
+  Buffer cpuA = input;
+  Buffer cpuB{};
+  std::cout << "CPU" << std::endl;
+  run(*createCpuGpu(), cpuA, cpuB);
+
+  Buffer fusedA = input;
+  Buffer fusedB{};
+  std::cout << "GPU, fused" << std::endl;
+  runFused(*createGpu(), fusedA, fusedB);
+
+  if (!matches(gpuA, cpuA) || !matches(gpuB, cpuB)) {
+    std::cout << "GPU results don't match the CPU reference" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!matches(fusedA, cpuA) || !matches(fusedB, cpuB)) {
+    std::cout << "Fused results don't match the CPU reference" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!checkAsyncRetrieval(*createGpu())) {
+    std::cout << "Async retrieval returned writes queued after it" << std::endl;
+    return EXIT_FAILURE;
+  }
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,299 @@
+#include "reduction.hpp"
+#include "cpu.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <limits>
+#include <mutex>
+
+namespace {
+
+// The minimum of maxComputeWorkGroupSize[0], so never clamped
+const uint32_t WorkgroupSize = 128;
+const uint32_t ItemsPerInvocation = 16;
+// Elements reduced or scanned by each workgroup
+const uint32_t BlockSize = WorkgroupSize * ItemsPerInvocation;
+
+const char* ReduceShaderPath = "shaders/reduce.glsl";
+const char* ReducePartialsShaderPath = "shaders/reduce_partials.glsl";
+const char* ScanShaderPath = "shaders/scan.glsl";
+const char* ScanPartialsShaderPath = "shaders/scan_partials.glsl";
+const char* ScanAddShaderPath = "shaders/scan_add.glsl";
+const char* ScanAddPartialsShaderPath = "shaders/scan_add_partials.glsl";
+
+// Matches the push constant block of reduction.glsl
+struct ReductionParams {
+  uint32_t count;
+  uint32_t op;
+  uint32_t exclusive;
+};
+
+uint32_t blockCount(uint32_t count) {
+  return std::max(1u, (count + BlockSize - 1) / BlockSize);
+}
+
+// CPU kernels are called on ranges of elements that needn't line up with blocks, so each handles
+// the blocks starting in its range, reading and writing past the end if need be
+template<typename F>
+void forEachBlock(uint32_t xBegin, uint32_t xEnd, uint32_t count, F&& fn) {
+  for (uint32_t block = (xBegin + BlockSize - 1) / BlockSize; block * BlockSize < xEnd;
+    ++block) {
+
+    uint32_t begin = block * BlockSize;
+    fn(block, begin, std::min(begin + BlockSize, count));
+  }
+}
+
+ReductionResult identity(ReduceOp op) {
+  switch (op) {
+    case ReduceOp::min:
+      return { std::numeric_limits<float>::infinity(), 0 };
+    case ReduceOp::max:
+    case ReduceOp::argmax:
+      return { -std::numeric_limits<float>::infinity(), std::numeric_limits<uint32_t>::max() };
+    default:
+      return {};
+  }
+}
+
+ReductionResult combine(ReduceOp op, const ReductionResult& a, const ReductionResult& b) {
+  switch (op) {
+    case ReduceOp::min:
+      return { std::min(a.value, b.value), 0 };
+    case ReduceOp::max:
+      return { std::max(a.value, b.value), 0 };
+    case ReduceOp::argmax:
+      return b.value > a.value || (b.value == a.value && b.index < a.index) ? b : a;
+    default:
+      return { a.value + b.value, 0 };
+  }
+}
+
+ReductionResult load(const netfloat_t* data, uint32_t i) {
+  return { data[i], i };
+}
+
+ReductionResult load(const ReductionResult* data, uint32_t i) {
+  return data[i];
+}
+
+// CPU equivalent of reduce.glsl for T = netfloat_t, and of reduce_partials.glsl for
+// T = ReductionResult
+template<typename T>
+void reduceKernel(const CpuKernelArgs& args, uint32_t xBegin, uint32_t xEnd, uint32_t,
+  uint32_t) {
+
+  const ReductionParams& params = *static_cast<const ReductionParams*>(args.pushConstants);
+  const T* input = static_cast<const T*>(args.buffers[0]);
+  ReductionResult* output = static_cast<ReductionResult*>(args.buffers[1]);
+  ReduceOp op = static_cast<ReduceOp>(params.op);
+
+  forEachBlock(xBegin, xEnd, params.count, [&](uint32_t block, uint32_t begin, uint32_t end) {
+    ReductionResult value = identity(op);
+    for (uint32_t i = begin; i < end; ++i) {
+      value = combine(op, value, load(input, i));
+    }
+    output[block] = value;
+  });
+}
+
+template<typename In, typename Out>
+void scanBlocks(const ReductionParams& params, const In* input, Out* output, float* blockSums,
+  uint32_t xBegin, uint32_t xEnd) {
+
+  forEachBlock(xBegin, xEnd, params.count, [&](uint32_t block, uint32_t begin, uint32_t end) {
+    float running = 0.f;
+    for (uint32_t i = begin; i < end; ++i) {
+      float value = input[i];
+      if (params.exclusive) {
+        output[i] = running;
+        running += value;
+      }
+      else {
+        running += value;
+        output[i] = running;
+      }
+    }
+    blockSums[block] = running;
+  });
+}
+
+// CPU equivalent of scan.glsl
+void scanKernel(const CpuKernelArgs& args, uint32_t xBegin, uint32_t xEnd, uint32_t, uint32_t) {
+  scanBlocks(*static_cast<const ReductionParams*>(args.pushConstants),
+    static_cast<const netfloat_t*>(args.buffers[0]), static_cast<netfloat_t*>(args.buffers[1]),
+    static_cast<float*>(args.buffers[2]), xBegin, xEnd);
+}
+
+// CPU equivalent of scan_partials.glsl
+void scanPartialsKernel(const CpuKernelArgs& args, uint32_t xBegin, uint32_t xEnd, uint32_t,
+  uint32_t) {
+
+  float* data = static_cast<float*>(args.buffers[0]);
+  scanBlocks(*static_cast<const ReductionParams*>(args.pushConstants), data, data,
+    static_cast<float*>(args.buffers[1]), xBegin, xEnd);
+}
+
+// CPU equivalent of scan_add.glsl for T = netfloat_t, and of scan_add_partials.glsl for
+// T = float
+template<typename T>
+void scanAddKernel(const CpuKernelArgs& args, uint32_t xBegin, uint32_t xEnd, uint32_t,
+  uint32_t) {
+
+  const ReductionParams& params = *static_cast<const ReductionParams*>(args.pushConstants);
+  T* data = static_cast<T*>(args.buffers[0]);
+  const float* offsets = static_cast<const float*>(args.buffers[1]);
+
+  uint32_t end = std::min(xEnd, params.count);
+  for (uint32_t i = xBegin; i < end; ++i) {
+    data[i] = data[i] + offsets[i / BlockSize];
+  }
+}
+
+void registerCpuKernels() {
+  registerCpuKernel(ReduceShaderPath, reduceKernel<netfloat_t>);
+  registerCpuKernel(ReducePartialsShaderPath, reduceKernel<ReductionResult>);
+  registerCpuKernel(ScanShaderPath, scanKernel);
+  registerCpuKernel(ScanPartialsShaderPath, scanPartialsKernel);
+  registerCpuKernel(ScanAddShaderPath, scanAddKernel<netfloat_t>);
+  registerCpuKernel(ScanAddPartialsShaderPath, scanAddKernel<float>);
+}
+
+}
+
+Reduction::Reduction(Gpu& gpu)
+  : m_gpu(gpu) {
+
+  static std::once_flag registered;
+  std::call_once(registered, registerCpuKernels);
+
+  std::vector<ShaderDesc> descs;
+  for (const char* path : { ReduceShaderPath, ReducePartialsShaderPath, ScanShaderPath,
+    ScanPartialsShaderPath, ScanAddShaderPath, ScanAddPartialsShaderPath }) {
+
+    ShaderDesc desc;
+    desc.sourcePath = path;
+    desc.workgroupSize = { WorkgroupSize, 1, 1 };
+    desc.elementsPerInvocation = { ItemsPerInvocation, 1, 1 };
+    desc.specializationConstants = { ItemsPerInvocation };
+
+    descs.push_back(desc);
+  }
+
+  std::vector<ShaderHandle> shaders = gpu.compileShaders(descs);
+
+  m_reduce = shaders[0];
+  m_reducePartials = shaders[1];
+  m_scan = shaders[2];
+  m_scanPartials = shaders[3];
+  m_scanAdd = shaders[4];
+  m_scanAddPartials = shaders[5];
+
+  m_result = gpu.allocateBuffer(sizeof(ReductionResult),
+    GpuBufferFlags::frequentHostAccess | GpuBufferFlags::hostReadAccess).handle;
+}
+
+void Reduction::queuePass(ShaderHandle shader, const GpuBufferBindings& bindings, uint32_t count,
+  ReduceOp op, bool exclusive) {
+
+  ReductionParams params{ count, static_cast<uint32_t>(op), exclusive };
+
+  // At least one workgroup, so that reducing nothing still writes the identity
+  m_gpu.queueShaderWithBindings(shader, bindings, { std::max(count, 1u), 1, 1 }, &params,
+    sizeof(params));
+}
+
+void Reduction::queueReduce(ReduceOp op, GpuBufferHandle input, uint32_t count,
+  GpuBufferHandle output) {
+
+  ShaderHandle shader = m_reduce;
+
+  for (size_t level = 0; ; ++level) {
+    uint32_t blocks = blockCount(count);
+    GpuBufferHandle partials = blocks == 1 ? output :
+      scratch(level, blocks * sizeof(ReductionResult));
+
+    queuePass(shader, { input, partials }, count, op);
+
+    if (blocks == 1) {
+      break;
+    }
+
+    shader = m_reducePartials;
+    input = partials;
+    count = blocks;
+  }
+}
+
+ReductionResult Reduction::reduce(ReduceOp op, GpuBufferHandle input, uint32_t count) {
+  queueReduce(op, input, count, m_result);
+
+  ReductionResult result;
+  m_gpu.retrieveBuffer(m_result, &result);
+
+  return result;
+}
+
+void Reduction::queueScan(GpuBufferHandle input, GpuBufferHandle output, uint32_t count,
+  bool exclusive) {
+
+  if (count == 0) {
+    return;
+  }
+
+  uint32_t blocks = blockCount(count);
+  GpuBufferHandle blockSums = scratch(0, blocks * sizeof(float));
+
+  queuePass(m_scan, { input, output, blockSums }, count, ReduceOp::sum, exclusive);
+
+  if (blocks > 1) {
+    queueScanPartials(1, blockSums, blocks);
+    queuePass(m_scanAdd, { output, blockSums }, count);
+  }
+}
+
+// Exclusive scan of count floats in place, for the offsets of the blocks of the level before
+void Reduction::queueScanPartials(size_t level, GpuBufferHandle data, uint32_t count) {
+  uint32_t blocks = blockCount(count);
+  GpuBufferHandle blockSums = scratch(level, blocks * sizeof(float));
+
+  queuePass(m_scanPartials, { data, blockSums }, count, ReduceOp::sum, true);
+
+  if (blocks > 1) {
+    queueScanPartials(level + 1, blockSums, blocks);
+    queuePass(m_scanAddPartials, { data, blockSums }, count);
+  }
+}
+
+// Replaced buffers are freed once queued work using them completes, so scratch space can grow
+// between queued passes
+GpuBufferHandle Reduction::scratch(size_t level, size_t size) {
+  if (level >= m_scratch.size()) {
+    m_scratch.resize(level + 1);
+  }
+
+  Scratch& scratch = m_scratch[level];
+  if (scratch.size < size) {
+    if (scratch.buffer != 0) {
+      m_gpu.freeBuffer(scratch.buffer);
+    }
+    scratch.buffer = m_gpu.allocateBuffer(size, GpuBufferFlags::large).handle;
+    scratch.size = size;
+  }
+
+  return scratch.buffer;
+}
+
+Reduction::~Reduction() {
+  for (const Scratch& scratch : m_scratch) {
+    if (scratch.buffer != 0) {
+      m_gpu.freeBuffer(scratch.buffer);
+    }
+  }
+  m_gpu.freeBuffer(m_result);
+
+  for (ShaderHandle shader : { m_reduce, m_reducePartials, m_scan, m_scanPartials, m_scanAdd,
+    m_scanAddPartials }) {
+
+    m_gpu.destroyShader(shader);
+  }
+}
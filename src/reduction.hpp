@@ -0,0 +1,60 @@
+#pragma once
+
+#include "gpu.hpp"
+#include <vector>
+
+enum class ReduceOp : uint32_t {
+  sum,
+  min,
+  max,
+  argmax
+};
+
+// What queueReduce() writes. index is only set by ReduceOp::argmax, and is the lowest index of
+// the largest element.
+struct ReductionResult {
+  float value = 0.f;
+  uint32_t index = 0;
+};
+
+// Reductions and prefix sums over buffers of netfloat_t, computed in float, so that only the
+// result need be read back. Each pass reduces blocks of elements to one value per workgroup, and
+// large inputs take several passes, with intermediate results kept in device scratch buffers.
+// Works on any Gpu, including the CPU backend.
+class Reduction {
+  public:
+    explicit Reduction(Gpu& gpu);
+
+    // Queues a reduction of the first count elements of input, writing a ReductionResult to the
+    // start of output
+    void queueReduce(ReduceOp op, GpuBufferHandle input, uint32_t count, GpuBufferHandle output);
+    // Reduces and waits for the result, reading back only the ReductionResult
+    ReductionResult reduce(ReduceOp op, GpuBufferHandle input, uint32_t count);
+    // Queues a prefix sum of the first count elements of input into output. Element i of output
+    // is the sum of input elements 0 to i, or to i - 1 if exclusive.
+    void queueScan(GpuBufferHandle input, GpuBufferHandle output, uint32_t count,
+      bool exclusive = false);
+
+    ~Reduction();
+
+  private:
+    struct Scratch {
+      GpuBufferHandle buffer = 0;
+      size_t size = 0;
+    };
+
+    void queuePass(ShaderHandle shader, const GpuBufferBindings& bindings, uint32_t count,
+      ReduceOp op = ReduceOp::sum, bool exclusive = false);
+    void queueScanPartials(size_t level, GpuBufferHandle data, uint32_t count);
+    GpuBufferHandle scratch(size_t level, size_t size);
+
+    Gpu& m_gpu;
+    ShaderHandle m_reduce;
+    ShaderHandle m_reducePartials;
+    ShaderHandle m_scan;
+    ShaderHandle m_scanPartials;
+    ShaderHandle m_scanAdd;
+    ShaderHandle m_scanAddPartials;
+    std::vector<Scratch> m_scratch; // By pass, grown as needed
+    GpuBufferHandle m_result;
+};
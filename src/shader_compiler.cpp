@@ -0,0 +1,219 @@
+#include "shader_compiler.hpp"
+#include "exception.hpp"
+#include "cache.hpp"
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <set>
+#include <sstream>
+
+#ifndef SHADERC_VERSION_STRING
+#define SHADERC_VERSION_STRING "unknown"
+#endif
+
+namespace {
+
+const uint32_t SpirvMagic = 0x07230203;
+
+class SourceIncluder : public shaderc::CompileOptions::IncluderInterface {
+  public:
+    SourceIncluder(const std::filesystem::path& sourcesDirectory)
+      : m_sourcesDirectory(sourcesDirectory) {}
+
+    shaderc_include_result* GetInclude(const char* requested_source,
+      shaderc_include_type type, const char* requesting_source, size_t include_depth) override;
+
+    void ReleaseInclude(shaderc_include_result* data) override;
+
+  private:
+    std::filesystem::path m_sourcesDirectory;
+};
+
+char* copyString(const std::string& str) {
+  char* buffer = new char[str.length() + 1];
+  strcpy(buffer, str.c_str());
+  return buffer;
+}
+
+shaderc_include_result* SourceIncluder::GetInclude(const char* requested_source,
+  shaderc_include_type, const char*, size_t) {
+
+  auto result = new shaderc_include_result{};
+
+  try {
+    auto sourcePath = m_sourcesDirectory / requested_source;
+    std::ifstream stream(sourcePath, std::ios::binary | std::ios::ate);
+
+    ASSERT_MSG(stream.good(), "Error opening file " << sourcePath);
+
+    size_t contentLength = stream.tellg();
+    stream.seekg(0);
+
+    char* contentBuffer = new char[contentLength];
+    stream.read(contentBuffer, contentLength);
+
+    result->source_name = copyString(sourcePath.string());
+    result->source_name_length = sourcePath.string().length();
+    result->content = contentBuffer;
+    result->content_length = contentLength;
+    result->user_data = nullptr;
+  }
+  catch (const std::exception& ex) {
+    // An empty source name tells shaderc the include failed, with content as the error
+    std::string message = ex.what();
+    result->source_name = copyString("");
+    result->source_name_length = 0;
+    result->content = copyString(message);
+    result->content_length = message.length();
+  }
+
+  return result;
+}
+
+void SourceIncluder::ReleaseInclude(shaderc_include_result* data) {
+  delete[] data->content;
+  delete[] data->source_name;
+  delete data;
+}
+
+std::string loadFile(const std::string& path) {
+  std::ifstream fin(path);
+  std::stringstream ss;
+  std::string line;
+  while (std::getline(fin, line)) {
+    ss << line << std::endl;
+  }
+  return ss.str();
+}
+
+// Hashes the contents of every file reachable through #include directives. Directives inside
+// inactive #if blocks are included too, which can only cause unnecessary cache misses.
+uint64_t hashIncludes(const std::filesystem::path& sourcesDirectory, const std::string& source,
+  uint64_t hash, std::set<std::string>& visited) {
+
+  static const std::regex includePattern("^\\s*#\\s*include\\s*[\"<]([^\">]+)[\">]");
+
+  std::stringstream stream(source);
+  std::string line;
+  while (std::getline(stream, line)) {
+    std::smatch match;
+    if (!std::regex_search(line, match, includePattern)) {
+      continue;
+    }
+
+    std::string name = match[1].str();
+    if (!visited.insert(name).second) {
+      continue;
+    }
+
+    std::string content = loadFile((sourcesDirectory / name).string());
+
+    hash = hashBytes(name.data(), name.size(), hash);
+    hash = hashBytes(content.data(), content.size(), hash);
+    hash = hashIncludes(sourcesDirectory, content, hash, visited);
+  }
+
+  return hash;
+}
+
+}
+
+ShaderCompiler::ShaderCompiler()
+  : m_cacheDirectory(cacheDirectory() / "spirv") {
+
+  std::error_code error;
+  std::filesystem::create_directories(m_cacheDirectory, error);
+}
+
+void ShaderCompiler::addDefinition(const std::string& name, const std::string& value) {
+  m_definitions.push_back({ name, value });
+}
+
+std::vector<uint32_t> ShaderCompiler::compile(const std::string& sourcePath,
+  const std::string& generatedSource) const {
+
+  std::string source = generatedSource.empty() ? loadFile(sourcePath) : generatedSource;
+  uint64_t key = cacheKey(sourcePath, source);
+
+  std::vector<uint32_t> code;
+  if (loadCached(key, code)) {
+    return code;
+  }
+
+  shaderc::CompileOptions options;
+
+  auto sourcesDirectory = std::filesystem::path(sourcePath).parent_path();
+
+  options.SetIncluder(std::make_unique<SourceIncluder>(sourcesDirectory));
+
+  for (const auto& definition : m_definitions) {
+    options.AddMacroDefinition(definition.first, definition.second);
+  }
+
+  auto result = m_compiler.CompileGlslToSpv(source,
+    shaderc_shader_kind::shaderc_glsl_compute_shader, sourcePath.c_str(), options);
+
+  if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+    EXCEPTION("Error compiling shader: " << result.GetErrorMessage());
+  }
+
+  code.assign(result.cbegin(), result.cend());
+
+  storeCached(key, code);
+
+  return code;
+}
+
+uint64_t ShaderCompiler::cacheKey(const std::string& sourcePath,
+  const std::string& source) const {
+
+  unsigned int spirvVersion = 0;
+  unsigned int spirvRevision = 0;
+  shaderc_get_spv_version(&spirvVersion, &spirvRevision);
+
+  std::stringstream options;
+  options << "shaderc=" << SHADERC_VERSION_STRING << ";spirv=" << spirvVersion << "."
+    << spirvRevision << ";kind=compute;env=default";
+
+  for (const auto& definition : m_definitions) {
+    options << ";-D" << definition.first << "=" << definition.second;
+  }
+
+  std::string optionsString = options.str();
+
+  uint64_t hash = hashBytes(optionsString.data(), optionsString.size());
+  hash = hashBytes(source.data(), source.size(), hash);
+
+  std::set<std::string> visited;
+  auto sourcesDirectory = std::filesystem::path(sourcePath).parent_path();
+
+  return hashIncludes(sourcesDirectory, source, hash, visited);
+}
+
+bool ShaderCompiler::loadCached(uint64_t key, std::vector<uint32_t>& code) const {
+  std::stringstream name;
+  name << std::hex << key << ".spv";
+
+  std::ifstream stream(m_cacheDirectory / name.str(), std::ios::binary | std::ios::ate);
+  if (!stream.good()) {
+    return false;
+  }
+
+  size_t size = stream.tellg();
+  if (size == 0 || size % sizeof(uint32_t) != 0) {
+    return false;
+  }
+
+  code.resize(size / sizeof(uint32_t));
+  stream.seekg(0);
+  stream.read(reinterpret_cast<char*>(code.data()), size);
+
+  return stream.good() && code[0] == SpirvMagic;
+}
+
+void ShaderCompiler::storeCached(uint64_t key, const std::vector<uint32_t>& code) const {
+  std::stringstream name;
+  name << std::hex << key << ".spv";
+
+  writeFileAtomic(m_cacheDirectory / name.str(), code.data(), code.size() * sizeof(uint32_t));
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <shaderc/shaderc.hpp>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Compiles GLSL compute shaders to SPIR-V, persisting results on disk. Cache entries are keyed
+// by the shader source, every file it transitively includes, the compile options and the
+// compiler version, so a warm start doesn't invoke the GLSL compiler at all.
+class ShaderCompiler {
+  public:
+    ShaderCompiler();
+
+    // Defines a preprocessor macro in every shader compiled from now on
+    void addDefinition(const std::string& name, const std::string& value = "");
+    // Compiles source, or the file at sourcePath if source is empty. Includes are resolved
+    // relative to sourcePath's directory either way.
+    std::vector<uint32_t> compile(const std::string& sourcePath,
+      const std::string& source = "") const;
+
+  private:
+    uint64_t cacheKey(const std::string& sourcePath, const std::string& source) const;
+    bool loadCached(uint64_t key, std::vector<uint32_t>& code) const;
+    void storeCached(uint64_t key, const std::vector<uint32_t>& code) const;
+
+    shaderc::Compiler m_compiler;
+    std::filesystem::path m_cacheDirectory;
+    std::vector<std::pair<std::string, std::string>> m_definitions;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "exception.hpp"
+#include <cstdint>
+#include <vector>
+
+// Stores values in reusable slots behind 32-bit handles. The low bits of a handle index the slot
+// and the high bits hold the slot's generation, which is bumped whenever the slot is freed, so
+// handles to erased values are detected rather than silently aliasing newer ones.
+template<typename T>
+class SlotMap {
+  public:
+    static const uint32_t IndexBits = 16;
+    static const uint32_t IndexMask = (1u << IndexBits) - 1;
+
+    uint32_t insert(T value) {
+      uint32_t index = 0;
+
+      if (!m_freeSlots.empty()) {
+        index = m_freeSlots.back();
+        m_freeSlots.pop_back();
+      }
+      else {
+        ASSERT_MSG(m_slots.size() <= IndexMask, "Exceeded " << IndexMask + 1 << " live slots");
+        index = m_slots.size();
+        m_slots.emplace_back();
+      }
+
+      Slot& slot = m_slots[index];
+      slot.value = std::move(value);
+      slot.occupied = true;
+
+      return (slot.generation << IndexBits) | index;
+    }
+
+    bool contains(uint32_t handle) const {
+      uint32_t index = handle & IndexMask;
+      return index < m_slots.size() && m_slots[index].occupied &&
+        m_slots[index].generation == (handle >> IndexBits);
+    }
+
+    T& operator[](uint32_t handle) {
+      ASSERT_MSG(contains(handle), "Invalid or stale handle " << handle);
+      return m_slots[handle & IndexMask].value;
+    }
+
+    const T& operator[](uint32_t handle) const {
+      ASSERT_MSG(contains(handle), "Invalid or stale handle " << handle);
+      return m_slots[handle & IndexMask].value;
+    }
+
+    // Returns the erased value
+    T erase(uint32_t handle) {
+      ASSERT_MSG(contains(handle), "Invalid or stale handle " << handle);
+
+      uint32_t index = handle & IndexMask;
+      Slot& slot = m_slots[index];
+
+      T value = std::move(slot.value);
+      slot.value = T{};
+      slot.occupied = false;
+      // Generations start at 1, so 0 is never a valid handle
+      slot.generation = (slot.generation + 1) & ((1u << (32 - IndexBits)) - 1);
+      if (slot.generation == 0) {
+        slot.generation = 1;
+      }
+
+      m_freeSlots.push_back(index);
+
+      return value;
+    }
+
+    template<typename F>
+    void forEach(F&& fn) {
+      for (auto& slot : m_slots) {
+        if (slot.occupied) {
+          fn(slot.value);
+        }
+      }
+    }
+
+  private:
+    struct Slot {
+      T value{};
+      uint32_t generation = 1;
+      bool occupied = false;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+};
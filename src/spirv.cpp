@@ -0,0 +1,259 @@
+#include "spirv.hpp"
+#include "exception.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace {
+
+const uint32_t SpirvMagic = 0x07230203;
+const size_t HeaderWords = 5;
+
+enum Opcode : uint32_t {
+  OpTypeBool = 20,
+  OpTypeInt = 21,
+  OpTypeFloat = 22,
+  OpTypeVector = 23,
+  OpTypeMatrix = 24,
+  OpTypeArray = 28,
+  OpTypeRuntimeArray = 29,
+  OpTypeStruct = 30,
+  OpTypePointer = 32,
+  OpConstant = 43,
+  OpVariable = 59,
+  OpDecorate = 71,
+  OpMemberDecorate = 72
+};
+
+enum Decoration : uint32_t {
+  DecorationBlock = 2,
+  DecorationBufferBlock = 3,
+  DecorationArrayStride = 6,
+  DecorationMatrixStride = 7,
+  DecorationNonWritable = 24,
+  DecorationNonReadable = 25,
+  DecorationBinding = 33,
+  DecorationDescriptorSet = 34,
+  DecorationOffset = 35
+};
+
+enum StorageClass : uint32_t {
+  StorageClassUniform = 2,
+  StorageClassPushConstant = 9,
+  StorageClassStorageBuffer = 12
+};
+
+struct Decorations {
+  bool block = false;
+  bool bufferBlock = false;
+  bool nonWritable = false;
+  bool nonReadable = false;
+  uint32_t binding = 0;
+  uint32_t set = 0;
+  uint32_t arrayStride = 0;
+};
+
+struct MemberAccess {
+  std::set<uint32_t> nonWritable;
+  std::set<uint32_t> nonReadable;
+};
+
+struct MemberLayout {
+  uint32_t offset = 0;
+  uint32_t matrixStride = 0;
+};
+
+struct Module {
+  std::map<uint32_t, Decorations> decorations;
+  std::map<uint32_t, MemberAccess> memberAccess;
+  std::map<uint32_t, std::map<uint32_t, MemberLayout>> memberLayouts;
+  std::map<uint32_t, std::vector<uint32_t>> types; // Opcode followed by operands
+  std::map<uint32_t, uint32_t> constants;
+  std::map<uint32_t, uint32_t> pointeeTypes;
+};
+
+struct Variable {
+  uint32_t id;
+  uint32_t pointerType;
+  uint32_t storageClass;
+};
+
+uint32_t typeSize(const Module& module, uint32_t typeId, uint32_t matrixStride = 0) {
+  const std::vector<uint32_t>& type = module.types.at(typeId);
+
+  switch (type[0]) {
+    case OpTypeBool:
+      return 4;
+    case OpTypeInt:
+    case OpTypeFloat:
+      return type[2] / 8;
+    case OpTypeVector:
+      return type[3] * typeSize(module, type[2]);
+    case OpTypeMatrix: {
+      uint32_t columnSize = matrixStride != 0 ? matrixStride : typeSize(module, type[2]);
+      return type[3] * columnSize;
+    }
+    case OpTypeArray: {
+      auto decorations = module.decorations.find(typeId);
+      uint32_t stride = decorations != module.decorations.end()
+        ? decorations->second.arrayStride : 0;
+      uint32_t length = module.constants.at(type[3]);
+      return length * (stride != 0 ? stride : typeSize(module, type[2]));
+    }
+    case OpTypeStruct: {
+      auto layouts = module.memberLayouts.find(typeId);
+      uint32_t size = 0;
+      for (uint32_t member = 0; member + 2 < type.size(); ++member) {
+        MemberLayout layout;
+        if (layouts != module.memberLayouts.end() && layouts->second.count(member)) {
+          layout = layouts->second.at(member);
+        }
+        else {
+          layout.offset = size;
+        }
+        size = std::max(size, layout.offset + typeSize(module, type[member + 2],
+          layout.matrixStride));
+      }
+      return size;
+    }
+  }
+
+  EXCEPTION("Unsupported SPIR-V type in block (opcode " << type[0] << ")");
+}
+
+}
+
+SpirvReflection reflectSpirv(const std::vector<uint32_t>& code) {
+  ASSERT_MSG(code.size() >= HeaderWords && code[0] == SpirvMagic, "Invalid SPIR-V module");
+
+  Module module;
+  auto& decorations = module.decorations;
+  auto& memberAccess = module.memberAccess;
+  auto& pointeeTypes = module.pointeeTypes;
+  std::vector<Variable> variables;
+
+  for (size_t i = HeaderWords; i < code.size();) {
+    uint32_t wordCount = code[i] >> 16;
+    uint32_t opcode = code[i] & 0xffff;
+
+    ASSERT_MSG(wordCount > 0 && i + wordCount <= code.size(), "Malformed SPIR-V instruction");
+
+    const uint32_t* operands = &code[i + 1];
+
+    switch (opcode) {
+      case OpDecorate: {
+        Decorations& target = decorations[operands[0]];
+        switch (operands[1]) {
+          case DecorationBlock: target.block = true; break;
+          case DecorationBufferBlock: target.bufferBlock = true; break;
+          case DecorationNonWritable: target.nonWritable = true; break;
+          case DecorationNonReadable: target.nonReadable = true; break;
+          case DecorationBinding: target.binding = operands[2]; break;
+          case DecorationDescriptorSet: target.set = operands[2]; break;
+          case DecorationArrayStride: target.arrayStride = operands[2]; break;
+        }
+        break;
+      }
+      case OpMemberDecorate: {
+        MemberAccess& target = memberAccess[operands[0]];
+        if (operands[2] == DecorationNonWritable) {
+          target.nonWritable.insert(operands[1]);
+        }
+        else if (operands[2] == DecorationNonReadable) {
+          target.nonReadable.insert(operands[1]);
+        }
+        else if (operands[2] == DecorationOffset) {
+          module.memberLayouts[operands[0]][operands[1]].offset = operands[3];
+        }
+        else if (operands[2] == DecorationMatrixStride) {
+          module.memberLayouts[operands[0]][operands[1]].matrixStride = operands[3];
+        }
+        break;
+      }
+      case OpTypeBool:
+      case OpTypeInt:
+      case OpTypeFloat:
+      case OpTypeVector:
+      case OpTypeMatrix:
+      case OpTypeArray:
+      case OpTypeRuntimeArray:
+      case OpTypeStruct: {
+        std::vector<uint32_t>& type = module.types[operands[0]];
+        type.push_back(opcode);
+        type.insert(type.end(), operands, operands + wordCount - 1);
+        break;
+      }
+      case OpConstant:
+        module.constants[operands[1]] = operands[2];
+        break;
+      case OpTypePointer:
+        pointeeTypes[operands[0]] = operands[2];
+        break;
+      case OpVariable:
+        variables.push_back(Variable{ operands[1], operands[0], operands[2] });
+        break;
+    }
+
+    i += wordCount;
+  }
+
+  SpirvReflection reflection;
+
+  for (const Variable& variable : variables) {
+    if (variable.storageClass == StorageClassPushConstant) {
+      reflection.pushConstantsSize = typeSize(module, pointeeTypes.at(variable.pointerType));
+      continue;
+    }
+
+    if (variable.storageClass != StorageClassUniform &&
+      variable.storageClass != StorageClassStorageBuffer) {
+
+      continue;
+    }
+
+    uint32_t structType = pointeeTypes.at(variable.pointerType);
+    const Decorations& typeDecorations = decorations[structType];
+    const Decorations& varDecorations = decorations[variable.id];
+
+    SpirvBufferBinding buffer;
+    buffer.set = varDecorations.set;
+    buffer.binding = varDecorations.binding;
+
+    bool isStorage = variable.storageClass == StorageClassStorageBuffer
+      || typeDecorations.bufferBlock;
+
+    buffer.type = isStorage ? SpirvBufferType::storage : SpirvBufferType::uniform;
+
+    // glslang places readonly/writeonly on the block members rather than the variable
+    const MemberAccess& members = memberAccess[structType];
+    const std::vector<uint32_t>& structDefinition = module.types[structType];
+    uint32_t memberCount = structDefinition.size() > 2 ? structDefinition.size() - 2 : 0;
+
+    bool nonWritable = varDecorations.nonWritable
+      || (memberCount > 0 && members.nonWritable.size() == memberCount);
+    bool nonReadable = varDecorations.nonReadable
+      || (memberCount > 0 && members.nonReadable.size() == memberCount);
+
+    buffer.writable = isStorage && !nonWritable;
+    buffer.readable = !nonReadable;
+
+    if (memberCount > 0) {
+      uint32_t lastMember = memberCount - 1;
+      auto arrayType = module.types.find(structDefinition.back());
+
+      if (arrayType != module.types.end() && arrayType->second[0] == OpTypeRuntimeArray) {
+        buffer.arrayOffset = module.memberLayouts[structType][lastMember].offset;
+        buffer.arrayStride = decorations[arrayType->first].arrayStride;
+      }
+    }
+
+    reflection.buffers.push_back(buffer);
+  }
+
+  std::sort(reflection.buffers.begin(), reflection.buffers.end(),
+    [](const SpirvBufferBinding& a, const SpirvBufferBinding& b) {
+      return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+
+  return reflection;
+}
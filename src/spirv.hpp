@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+enum class SpirvBufferType {
+  uniform,
+  storage
+};
+
+struct SpirvBufferBinding {
+  uint32_t set = 0;
+  uint32_t binding = 0;
+  SpirvBufferType type = SpirvBufferType::storage;
+  bool readable = true;
+  bool writable = true;
+  // Offset and stride of the runtime array ending the block, if any. Bytes of the buffer after
+  // the last whole element are out of the shader's reach.
+  uint32_t arrayOffset = 0;
+  uint32_t arrayStride = 0;
+};
+
+struct SpirvReflection {
+  std::vector<SpirvBufferBinding> buffers; // Sorted by set, then binding
+  uint32_t pushConstantsSize = 0;
+};
+
+// Extracts the resource interface of a compiled shader module
+SpirvReflection reflectSpirv(const std::vector<uint32_t>& code);
@@ -0,0 +1,22 @@
+#include "timing_stats.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+GpuTimingStats timingStats(std::vector<double> samples) {
+  GpuTimingStats stats;
+  if (samples.empty()) {
+    return stats;
+  }
+
+  std::sort(samples.begin(), samples.end());
+
+  size_t p99Index = static_cast<size_t>(std::ceil(samples.size() * 0.99)) - 1;
+
+  stats.count = samples.size();
+  stats.min = samples.front();
+  stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+  stats.p99 = samples[std::min(p99Index, samples.size() - 1)];
+
+  return stats;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "gpu.hpp"
+#include <vector>
+
+// Summarises samples in microseconds
+GpuTimingStats timingStats(std::vector<double> samples);
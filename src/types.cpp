@@ -0,0 +1,62 @@
+#include "types.hpp"
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+// The scalar loops are branch-free apart from rare special cases, so compilers vectorise them.
+// F16C converts eight halves per instruction where available.
+
+#if defined(NETFLOAT_FP16)
+
+void toNetfloat(const float* src, netfloat_t* dst, size_t count) {
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= count; i += 8) {
+    __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), halves);
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i].bits = floatToHalf(src[i]);
+  }
+}
+
+void fromNetfloat(const netfloat_t* src, float* dst, size_t count) {
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= count; i += 8) {
+    __m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(halves));
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = halfToFloat(src[i].bits);
+  }
+}
+
+#elif defined(NETFLOAT_BF16)
+
+void toNetfloat(const float* src, netfloat_t* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i].bits = floatToBfloat16(src[i]);
+  }
+}
+
+void fromNetfloat(const netfloat_t* src, float* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = bfloat16ToFloat(src[i].bits);
+  }
+}
+
+#else
+
+void toNetfloat(const float* src, netfloat_t* dst, size_t count) {
+  memcpy(dst, src, count * sizeof(float));
+}
+
+void fromNetfloat(const netfloat_t* src, float* dst, size_t count) {
+  memcpy(dst, src, count * sizeof(float));
+}
+
+#endif
@@ -1,3 +1,128 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// IEEE half precision, stored only. Values convert to and from float, rounding to nearest even.
+struct half_t {
+  uint16_t bits = 0;
+
+  half_t() = default;
+  half_t(float value);
+  operator float() const;
+};
+
+// The top half of a float, trading half_t's precision for float's range
+struct bfloat16_t {
+  uint16_t bits = 0;
+
+  bfloat16_t() = default;
+  bfloat16_t(float value);
+  operator float() const;
+};
+
+// Storage type of buffer elements, selected with the NETFLOAT_TYPE CMake option. The 16-bit
+// types halve memory traffic. Arithmetic is done in float on both host and device.
+#if defined(NETFLOAT_FP16)
+using netfloat_t = half_t;
+#elif defined(NETFLOAT_BF16)
+using netfloat_t = bfloat16_t;
+#else
 using netfloat_t = float;
+#endif
+
+// Bulk conversions, vectorised where the target allows
+void toNetfloat(const float* src, netfloat_t* dst, size_t count);
+void fromNetfloat(const netfloat_t* src, float* dst, size_t count);
+
+inline uint32_t floatBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline float bitsFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// After F. Giesen's float_to_half_fast3_rtne
+inline uint16_t floatToHalf(float value) {
+  const uint32_t infinity = 255u << 23;
+  const uint32_t halfOverflow = (127u + 16u) << 23;
+  const uint32_t denormalMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+  uint32_t bits = floatBits(value);
+  uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+
+  uint16_t half;
+
+  if (bits >= halfOverflow) {
+    // Infinity, or NaN kept quiet
+    half = bits > infinity ? 0x7e00 : 0x7c00;
+  }
+  else if (bits < (113u << 23)) {
+    // Too small for a normal half, so let the FPU round the mantissa into place
+    half = static_cast<uint16_t>(floatBits(bitsFloat(bits) + bitsFloat(denormalMagic))
+      - denormalMagic);
+  }
+  else {
+    uint32_t mantissaOdd = (bits >> 13) & 1;
+    bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff;
+    bits += mantissaOdd;
+    half = static_cast<uint16_t>(bits >> 13);
+  }
+
+  return half | static_cast<uint16_t>(sign >> 16);
+}
+
+inline float halfToFloat(uint16_t half) {
+  const uint32_t shiftedExponent = 0x7c00u << 13;
+
+  uint32_t bits = (half & 0x7fffu) << 13;
+  uint32_t exponent = bits & shiftedExponent;
+  bits += (127u - 15u) << 23;
+
+  if (exponent == shiftedExponent) {
+    bits += (128u - 16u) << 23;
+  }
+  else if (exponent == 0) {
+    bits += 1u << 23;
+    bits = floatBits(bitsFloat(bits) - bitsFloat(113u << 23));
+  }
+
+  return bitsFloat(bits | (static_cast<uint32_t>(half & 0x8000u) << 16));
+}
+
+inline uint16_t floatToBfloat16(float value) {
+  uint32_t bits = floatBits(value);
+
+  // Truncating could turn a NaN into infinity, so keep it a quiet NaN
+  if ((bits & 0x7fffffffu) > 0x7f800000u) {
+    return static_cast<uint16_t>((bits >> 16) | 0x40);
+  }
+
+  bits += 0x7fffu + ((bits >> 16) & 1);
+  return static_cast<uint16_t>(bits >> 16);
+}
+
+inline float bfloat16ToFloat(uint16_t value) {
+  return bitsFloat(static_cast<uint32_t>(value) << 16);
+}
+
+inline half_t::half_t(float value)
+  : bits(floatToHalf(value)) {}
+
+inline half_t::operator float() const {
+  return halfToFloat(bits);
+}
+
+inline bfloat16_t::bfloat16_t(float value)
+  : bits(floatToBfloat16(value)) {}
+
+inline bfloat16_t::operator float() const {
+  return bfloat16ToFloat(bits);
+}
@@ -1,98 +1,145 @@
 #include "gpu.hpp"
 #include "exception.hpp"
+#include "vulkan_utils.hpp"
+#include "device_allocator.hpp"
+#include "descriptor_allocator.hpp"
+#include "hazard_tracker.hpp"
+#include "spirv.hpp"
+#include "cache.hpp"
+#include "shader_compiler.hpp"
+#include "work_stealing_pool.hpp"
+#include "slot_map.hpp"
+#include "timing_stats.hpp"
 #include <vulkan/vulkan.h>
-#include <shaderc/shaderc.hpp>
 #include <iostream>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <chrono>
 #include <cstring>
 #include <algorithm>
 #include <filesystem>
 #include <sstream>
 #include <fstream>
 
-#define VK_CHECK(fnCall, msg) \
-  { \
-    VkResult code = fnCall; \
-    if (code != VK_SUCCESS) { \
-      EXCEPTION(msg << " (result: " << code << ")"); \
-    } \
-  }
-
 namespace {
 
-class SourceIncluder : public shaderc::CompileOptions::IncluderInterface {
-  public:
-    SourceIncluder(const std::filesystem::path& sourcesDirectory)
-      : m_sourcesDirectory(sourcesDirectory) {}
-
-    shaderc_include_result* GetInclude(const char* requested_source,
-      shaderc_include_type type, const char* requesting_source, size_t include_depth) override;
+const VkDeviceSize InitialStagingBufferSize = 1024 * 1024;
+const uint32_t QueriesPerPool = 256;
 
-    void ReleaseInclude(shaderc_include_result* data) override;
+// Indices into Vulkan::m_queues. Without a separate transfer queue, everything goes to the
+// compute queue.
+const size_t ComputeQueue = 0;
+const size_t TransferQueue = 1;
 
-  private:
-    std::filesystem::path m_sourcesDirectory;
-    std::string m_errorMessage;
+const std::vector<const char*> ValidationLayers = {
+  "VK_LAYER_KHRONOS_validation"
 };
 
-shaderc_include_result* SourceIncluder::GetInclude(const char* requested_source,
-  shaderc_include_type, const char*, size_t) {
-
-  auto result = new shaderc_include_result{};
-
-  try {
-    auto sourcePath = m_sourcesDirectory.append(requested_source);
-    std::ifstream stream(sourcePath, std::ios::binary | std::ios::ate);
-
-    ASSERT_MSG(stream.good(), "Error opening file " << sourcePath);
+struct Buffer {
+  VkBuffer handle = VK_NULL_HANDLE;
+  DeviceAllocation allocation;
+  VkDeviceSize size = 0;
+  VkDeviceSize boundSize = 0; // Bound to shaders, which may include padding after size
+  VkDescriptorType type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  GpuTicket lastUse = 0; // The latest batch to use the buffer, possibly not yet submitted
+};
 
-    size_t contentLength = stream.tellg();
-    stream.seekg(0);
+struct StagingRegion {
+  VkDeviceSize begin = 0;
+  VkDeviceSize end = 0;
+  GpuTicket ticket = 0; // 0 until the copy using the region has been submitted
+};
 
-    char* contentBuffer = new char[contentLength];
-    stream.read(contentBuffer, contentLength);
+// Persistently mapped host memory used for all uploads and readbacks. Requests are suballocated
+// linearly; the ring wraps once the work referencing its contents has completed.
+struct StagingBuffer {
+  VkBuffer handle = VK_NULL_HANDLE;
+  DeviceAllocation allocation;
+  VkDeviceSize size = 0;
+  char* data = nullptr;
+  std::deque<StagingRegion> regions; // Oldest first
+};
 
-    size_t sourceNameLength = sourcePath.string().length();
-    char* nameBuffer = new char[sourceNameLength];
-    strcpy(nameBuffer, sourcePath.c_str());
+enum class TimingCategory {
+  shader,
+  upload,
+  download
+};
 
-    result->source_name = nameBuffer;
-    result->source_name_length = sourceNameLength;
-    result->content = contentBuffer;
-    result->content_length = contentLength;
-    result->user_data = nullptr;
-  }
-  catch (const std::exception& ex) {
-    m_errorMessage = ex.what();
-    result->content = m_errorMessage.c_str();
-    result->content_length = m_errorMessage.length();
-  }
+// A pair of timestamp queries written around one command
+struct TimedCommand {
+  VkQueryPool pool = VK_NULL_HANDLE;
+  uint32_t query = 0; // The first of the pair
+  size_t queue = 0;
+  TimingCategory category = TimingCategory::shader;
+  ShaderHandle shader = 0;
+};
 
-  return result;
-}
+struct Submission {
+  GpuTicket ticket = 0;
+  std::array<VkFence, 2> fences{ VK_NULL_HANDLE, VK_NULL_HANDLE }; // Per queue, if used
+  std::array<std::vector<VkCommandBuffer>, 2> transientCommandBuffers;
+  std::vector<VkSemaphore> semaphores;
+  std::vector<std::function<void()>> callbacks;
+  std::vector<std::function<void()>> releases; // Destroy objects the submission used
+  std::vector<TimedCommand> timedCommands;
+  std::vector<VkQueryPool> queryPools;
+};
 
-void SourceIncluder::ReleaseInclude(shaderc_include_result* data) {
-  delete[] data->content;
-  delete[] data->source_name;
-  delete data;
-}
+struct Queue {
+  uint32_t family = 0;
+  VkQueue handle = VK_NULL_HANDLE;
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  std::vector<VkCommandBuffer> transientCommandBuffers; // Recycled once submitted work completes
+  std::vector<VkCommandBuffer> freeCommandBuffers;
+  HazardTracker hazards;
+  uint64_t submittedSerial = 0; // Latest segment submitted to this queue
+  uint64_t waitedSerial = 0; // Latest segment on the other queue this queue has waited for
+  uint64_t timestampMask = 0; // Valid bits of timestamps, or zero if the queue can't write them
+  bool resetsQueries = false; // In command buffers, which transfer-only families can't
+};
 
-const std::vector<const char*> ValidationLayers = {
-  "VK_LAYER_KHRONOS_validation"
+// A run of consecutively queued work for one queue. Segments are numbered in queue order, and a
+// segment only has to wait for the other queue if it touches buffers the other queue used.
+struct Segment {
+  size_t queue = ComputeQueue;
+  uint64_t serial = 0;
+  uint64_t waitSerial = 0; // Latest segment on the other queue that this one depends on
+  std::vector<VkCommandBuffer> commandBuffers;
 };
 
-struct Buffer {
-  VkBuffer handle = VK_NULL_HANDLE;
-  VkDeviceMemory memory = VK_NULL_HANDLE;
-  VkDeviceSize size = 0;
-  VkDescriptorType type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+// The latest segments to access a buffer on each queue
+struct BufferSerials {
+  std::array<uint64_t, 2> write{};
+  std::array<uint64_t, 2> read{};
 };
 
 struct Pipeline {
+  std::string sourcePath;
+  std::vector<uint32_t> spirv;
+  std::array<uint32_t, 3> workgroupSize{ 1, 1, 1 };
+  std::array<uint32_t, 3> elementsPerInvocation{ 1, 1, 1 };
+  std::vector<uint32_t> specializationConstants; // From constant_id 3
+  uint32_t pushConstantsSize = 0;
   VkPipeline handle = VK_NULL_HANDLE;
   VkPipelineLayout layout = VK_NULL_HANDLE;
   VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
-  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  GpuBufferBindings bufferBindings; // Defaults used by queueShader(), possibly empty
+  std::vector<SpirvBufferBinding> reflectedBuffers;
+  GpuTicket lastUse = 0;
+};
+
+// The binding numbers and descriptor types of a descriptor set layout
+using DescriptorLayoutKey = std::vector<std::pair<uint32_t, VkDescriptorType>>;
+
+struct PipelineDesc {
+  const std::vector<uint32_t>* spirv = nullptr;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  std::array<uint32_t, 3> workgroupSize{ 1, 1, 1 };
+  std::vector<uint32_t> specializationConstants; // From constant_id 3
 };
 
 class Vulkan : public Gpu {
@@ -101,11 +148,38 @@ class Vulkan : public Gpu {
 
     ShaderHandle compileShader(const std::string& sourcePath,
       const GpuBufferBindings& bufferBindings, const Size3& workgroupSize) override;
+    std::vector<ShaderHandle> compileShaders(const std::vector<ShaderDesc>& shaders) override;
     GpuBuffer allocateBuffer(size_t size, GpuBufferFlags flags) override;
+    void freeBuffer(GpuBufferHandle buffer) override;
+    void destroyShader(ShaderHandle shader) override;
     void submitBufferData(GpuBufferHandle buffer, const void* data) override;
-    void queueShader(ShaderHandle shaderHandle) override;
+    void submitBufferData(GpuBufferHandle buffer, const void* data, size_t offset,
+      size_t size) override;
+    void submitBufferRegions(GpuBufferHandle buffer, const void* data,
+      const std::vector<GpuBufferRegion>& regions) override;
+    void queueShader(ShaderHandle shaderHandle, const Size3& problemSize,
+      const void* pushConstants, size_t pushConstantsSize) override;
+    void queueShaderWithBindings(ShaderHandle shaderHandle, const GpuBufferBindings& bufferBindings,
+      const Size3& problemSize, const void* pushConstants, size_t pushConstantsSize) override;
+    std::array<uint32_t, 3> tuneWorkgroupSize(ShaderHandle shaderHandle,
+      const Size3& problemSize, const void* pushConstants, size_t pushConstantsSize) override;
     void retrieveBuffer(GpuBufferHandle buffer, void* data) override;
+    void retrieveBuffer(GpuBufferHandle buffer, void* data, size_t offset, size_t size) override;
+    void retrieveBufferRegions(GpuBufferHandle buffer, void* data,
+      const std::vector<GpuBufferRegion>& regions) override;
+    void retrieveBufferAsync(GpuBufferHandle buffer, void* data, size_t offset,
+      size_t size) override;
     void flushQueue() override;
+    GpuTicket flushQueueAsync() override;
+    bool isComplete(GpuTicket ticket) override;
+    void wait(GpuTicket ticket) override;
+    void onComplete(GpuTicket ticket, std::function<void()> callback) override;
+    void beginSequence() override;
+    GpuSequenceHandle endSequence() override;
+    void queueSequence(GpuSequenceHandle sequence) override;
+    void setProfilingEnabled(bool enabled) override;
+    GpuProfile profile() override;
+    void resetProfile() override;
 
     ~Vulkan();
 
@@ -119,33 +193,114 @@ class Vulkan : public Gpu {
     void pickPhysicalDevice();
     void createLogicalDevice();
     uint32_t findComputeQueueFamily() const;
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+    bool findTransferQueue(uint32_t computeFamily, uint32_t& family, uint32_t& index) const;
+    size_t transferQueue() const;
+    void trackQueueDependencies(size_t queue, const std::vector<BufferAccess>& accesses);
+    VkSemaphore signalSemaphore(size_t queue);
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
+      const std::vector<VkBufferCopy>& regions);
+    VkDeviceSize regionsSize(const Buffer& buffer,
+      const std::vector<GpuBufferRegion>& regions) const;
+    void uploadRegions(GpuBufferHandle bufferHandle, const char* data,
+      const std::vector<GpuBufferRegion>& regions, size_t hostBase);
+    void downloadRegions(GpuBufferHandle bufferHandle, char* data,
+      const std::vector<GpuBufferRegion>& regions, size_t hostBase);
+    VkDeviceSize stageData(VkDeviceSize size);
+    bool findStagingSpace(VkDeviceSize size, VkDeviceSize& offset) const;
+    void createStagingBuffer(VkDeviceSize size);
+    void destroyStagingBuffer();
     void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-      VkBuffer& buffer, VkDeviceMemory& bufferMemory) const;
-    VkDescriptorSetLayout createDescriptorSetLayout(const GpuBufferBindings& buffers);
-    VkPipelineLayout createPipelineLayout(VkDescriptorSetLayout descriptorSetLayout);
+      VkBuffer& buffer, DeviceAllocation& allocation,
+      VkMemoryPropertyFlags preferredProperties = 0);
+    bool supportsZeroCopy() const;
+    bool supportsSubgroupArithmetic() const;
+    void waitForBufferIdle(const Buffer& buffer);
+    void releaseAfter(GpuTicket ticket, std::function<void()> release);
+    VkDescriptorSetLayout descriptorSetLayout(const std::vector<SpirvBufferBinding>& buffers);
+    VkPipelineLayout createPipelineLayout(VkDescriptorSetLayout descriptorSetLayout,
+      uint32_t pushConstantsSize);
     void createCommandPool();
-    void createDescriptorPool();
-    VkDescriptorSet createDescriptorSet(const GpuBufferBindings& buffers,
-      VkDescriptorSetLayout layout);
-    VkCommandBuffer createCommandBuffer();
-    void dispatchWorkgroups(VkCommandBuffer commandBuffer, size_t pipelineIdx,
-      const Size3& numWorkgroups);
-    void createSyncObjects();
+    VkDescriptorSet descriptorSet(const Pipeline& pipeline, const GpuBufferBindings& buffers);
+    void releaseDescriptorSets(GpuBufferHandle buffer);
+    VkCommandBuffer createCommandBuffer(size_t queue);
+    void beginCommandBuffer(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags flags);
+    VkCommandBuffer currentCommandBuffer(size_t queue = ComputeQueue);
+    HazardTracker& currentHazards();
+    void endBatchCommandBuffer();
+    std::vector<BufferAccess> shaderAccesses(const Pipeline& pipeline,
+      const GpuBufferBindings& bufferBindings) const;
+    void dispatchWorkgroups(VkCommandBuffer commandBuffer, ShaderHandle shaderHandle,
+      VkDescriptorSet descriptorSet, const Size3& numWorkgroups, const void* pushConstants);
+    std::array<uint32_t, 3> clampWorkgroupSize(const Size3& workgroupSize) const;
+    std::array<uint32_t, 3> workgroupCount(const Pipeline& pipeline,
+      const Size3& problemSize) const;
+    VkPipeline createComputePipeline(const Pipeline& pipeline, const Size3& workgroupSize) const;
+    std::vector<VkPipeline> createComputePipelines(const std::vector<PipelineDesc>& descs) const;
+    std::vector<std::array<uint32_t, 3>> workgroupSizeCandidates(const Size3& problemSize) const;
+    std::string tuningKey(const Pipeline& pipeline, const Size3& problemSize) const;
+    void loadTuningCache();
+    void saveTuningCache() const;
+    void createPipelineCache();
+    void savePipelineCache() const;
+    VkFence acquireFence();
+    VkSemaphore acquireSemaphore();
+    VkQueryPool acquireQueryPool();
+    bool beginTiming(VkCommandBuffer commandBuffer, size_t queue, TimedCommand& command);
+    void endTiming(VkCommandBuffer commandBuffer, const TimedCommand& command);
+    void collectTimings(const Submission& submission);
+    void retireSubmissions();
+    void retireOldestSubmission();
     void destroyDebugMessenger();
-    VkShaderModule createShaderModule(const std::string& sourcePath) const;
+    VkShaderModule createShaderModule(const std::vector<uint32_t>& code) const;
 
     VkInstance m_instance;
     VkDebugUtilsMessengerEXT m_debugMessenger;
     VkPhysicalDevice m_physicalDevice;
     VkDevice m_device;
-    VkQueue m_computeQueue; // TODO: Separate queue for transfers?
-    std::vector<Buffer> m_buffers;
-    std::vector<Pipeline> m_pipelines;
-    VkCommandPool m_commandPool;
-    std::vector<VkCommandBuffer> m_commandBuffers;
-    VkDescriptorPool m_descriptorPool;
-    VkFence m_taskCompleteFence;
+    std::array<Queue, 2> m_queues;
+    bool m_separateTransferQueue = false;
+    bool m_zeroCopy = false; // Host-accessed buffers live in mapped device-local memory
+    bool m_16BitStorage = false; // Shaders may load and store 16-bit types in storage buffers
+    PFN_vkResetQueryPoolEXT m_resetQueryPool = nullptr; // Set if query pools can be reset by host
+    std::unique_ptr<DeviceAllocator> m_allocator;
+    ShaderCompiler m_shaderCompiler;
+    SlotMap<Buffer> m_buffers;
+    SlotMap<Pipeline> m_pipelines;
+    std::vector<VkPipeline> m_retiredPipelines; // Replaced by tuning, but may be in sequences
+    std::map<std::string, std::array<uint32_t, 3>> m_tunedWorkgroupSizes;
+    std::vector<Segment> m_segments; // Queued for the next submission, in order
+    uint64_t m_nextSerial = 1;
+    std::unordered_map<VkBuffer, BufferSerials> m_bufferSerials;
+    std::array<uint64_t, 2> m_unknownWriteSerial{}; // Latest segment that may write any buffer
+    VkCommandBuffer m_batchCommandBuffer = VK_NULL_HANDLE; // Still being recorded
+    size_t m_batchQueue = ComputeQueue;
+    bool m_hazardsUnknown = false; // Set when queued sequences may have touched any buffer
+    std::vector<VkCommandBuffer> m_sequences;
+    GpuTicket m_lastSequenceUse = 0; // Sequences may use any buffer
+    HazardTracker m_sequenceHazards;
+    bool m_recordingSequence = false;
+    VkPhysicalDeviceProperties m_deviceProperties;
+    StagingBuffer m_stagingBuffer;
+    std::unique_ptr<DescriptorAllocator> m_descriptorAllocator;
+    // Layouts are shared by all shaders with the same resource interface and live as long as this
+    std::map<DescriptorLayoutKey, VkDescriptorSetLayout> m_descriptorSetLayouts;
+    // Shared by all shaders with the same layout and bindings. Freed along with their buffers.
+    std::map<std::pair<VkDescriptorSetLayout, GpuBufferBindings>, VkDescriptorSet>
+      m_descriptorSets;
+    VkPipelineCache m_pipelineCache;
+    std::deque<Submission> m_submissions; // Oldest first
+    std::vector<VkFence> m_freeFences;
+    std::vector<VkSemaphore> m_freeSemaphores;
+    GpuTicket m_nextTicket = 1;
+    std::vector<std::function<void()>> m_batchReleases; // Run after the next submission
+    bool m_profiling = false;
+    std::vector<VkQueryPool> m_freeQueryPools;
+    std::vector<VkQueryPool> m_batchQueryPools; // Only the last may have queries left
+    uint32_t m_nextQuery = QueriesPerPool; // In the last of m_batchQueryPools
+    std::vector<TimedCommand> m_batchTimedCommands;
+    std::map<ShaderHandle, std::vector<double>> m_shaderTimings; // Microseconds
+    std::vector<double> m_uploadTimings;
+    std::vector<double> m_downloadTimings;
 };
 
 Vulkan::Vulkan() {
@@ -155,13 +310,30 @@ Vulkan::Vulkan() {
 #endif
   pickPhysicalDevice();
   createLogicalDevice();
+  m_allocator = std::make_unique<DeviceAllocator>(m_physicalDevice, m_device);
+  m_zeroCopy = supportsZeroCopy();
   createCommandPool();
-  createDescriptorPool();
-  createSyncObjects();
+  m_descriptorAllocator = std::make_unique<DescriptorAllocator>(m_device);
+  createStagingBuffer(InitialStagingBufferSize);
+  createPipelineCache();
+  loadTuningCache();
+
+#if defined(NETFLOAT_FP16)
+  m_shaderCompiler.addDefinition("NETFLOAT_FP16");
+#elif defined(NETFLOAT_BF16)
+  m_shaderCompiler.addDefinition("NETFLOAT_BF16");
+#endif
+  if (m_16BitStorage) {
+    m_shaderCompiler.addDefinition("NETFLOAT_16BIT_STORAGE");
+  }
+  if (supportsSubgroupArithmetic()) {
+    m_shaderCompiler.addDefinition("SUBGROUP_ARITHMETIC");
+  }
 }
 
-void chooseVulkanBufferFlags(GpuBufferFlags flags, VkMemoryPropertyFlags& memProps,
-  VkBufferUsageFlags& usage, VkDescriptorType& type, bool& memoryMapped) {
+void chooseVulkanBufferFlags(GpuBufferFlags flags, bool zeroCopy, VkMemoryPropertyFlags& memProps,
+  VkMemoryPropertyFlags& preferredMemProps, VkBufferUsageFlags& usage, VkDescriptorType& type,
+  bool& memoryMapped) {
 
   if (!!(flags & GpuBufferFlags::shaderReadonly) && !(flags & GpuBufferFlags::large)) {
     type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -181,179 +353,1374 @@ void chooseVulkanBufferFlags(GpuBufferFlags flags, VkMemoryPropertyFlags& memPro
         usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
         memoryMapped = false;
       }
-      if (!!(flags & GpuBufferFlags::hostWriteAccess)) {
-        usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        memoryMapped = false;
+      if (!!(flags & GpuBufferFlags::hostWriteAccess)) {
+        usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        memoryMapped = false;
+      }
+      memProps = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+      // Skip the staging copy by mapping the device-local memory directly
+      bool hostAccess = !!(flags & (GpuBufferFlags::hostReadAccess
+                                  | GpuBufferFlags::hostWriteAccess));
+      if (zeroCopy && hostAccess) {
+        memProps |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        memoryMapped = true;
+
+        // Readbacks from uncached memory are very slow
+        preferredMemProps = !!(flags & GpuBufferFlags::hostReadAccess) ?
+          VK_MEMORY_PROPERTY_HOST_CACHED_BIT : VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+      }
+    }
+  }
+
+  // retrieveBufferAsync() copies mapped buffers via staging while work uses them
+  if (memoryMapped) {
+    usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  }
+}
+
+GpuBuffer Vulkan::allocateBuffer(size_t size, GpuBufferFlags flags) {
+  Buffer buffer;
+  buffer.size = size;
+  buffer.boundSize = size;
+
+#if defined(NETFLOAT_FP16) || defined(NETFLOAT_BF16)
+  // Packed into uints, so an odd number of elements needs a trailing half word to be bindable
+  if (!m_16BitStorage) {
+    buffer.boundSize = alignUp(size, sizeof(uint32_t));
+  }
+#endif
+
+  VkMemoryPropertyFlags memProps = 0;
+  VkMemoryPropertyFlags preferredMemProps = 0;
+  VkBufferUsageFlags usage = 0;
+  bool memoryMapped = false;
+
+  chooseVulkanBufferFlags(flags, m_zeroCopy, memProps, preferredMemProps, usage, buffer.type,
+    memoryMapped);
+
+  GpuBuffer gpuBuffer;
+
+  createBuffer(buffer.boundSize, usage, memProps, buffer.handle, buffer.allocation,
+    preferredMemProps);
+  if (memoryMapped) {
+    gpuBuffer.data = buffer.allocation.data;
+  }
+
+  gpuBuffer.handle = m_buffers.insert(buffer);
+
+  return gpuBuffer;
+}
+
+void Vulkan::freeBuffer(GpuBufferHandle bufferHandle) {
+  Buffer buffer = m_buffers.erase(bufferHandle);
+
+  releaseAfter(std::max(buffer.lastUse, m_lastSequenceUse), [this, bufferHandle, buffer]() {
+    for (Queue& queue : m_queues) {
+      queue.hazards.forget(buffer.handle);
+    }
+    m_sequenceHazards.forget(buffer.handle);
+    m_bufferSerials.erase(buffer.handle);
+    releaseDescriptorSets(bufferHandle);
+
+    vkDestroyBuffer(m_device, buffer.handle, nullptr);
+    m_allocator->free(buffer.allocation);
+  });
+}
+
+void Vulkan::destroyShader(ShaderHandle shaderHandle) {
+  Pipeline pipeline = m_pipelines.erase(shaderHandle);
+
+  releaseAfter(std::max(pipeline.lastUse, m_lastSequenceUse), [this, pipeline]() {
+    vkDestroyPipeline(m_device, pipeline.handle, nullptr);
+    vkDestroyPipelineLayout(m_device, pipeline.layout, nullptr);
+  });
+}
+
+// Runs release once the work of the given ticket, which may not have been submitted yet, has
+// completed
+void Vulkan::releaseAfter(GpuTicket ticket, std::function<void()> release) {
+  if (ticket >= m_nextTicket) {
+    m_batchReleases.push_back(std::move(release));
+    return;
+  }
+
+  if (m_submissions.empty() || m_submissions.front().ticket > ticket) {
+    release();
+    return;
+  }
+
+  auto i = std::find_if(m_submissions.begin(), m_submissions.end(),
+    [ticket](const Submission& submission) { return submission.ticket == ticket; });
+
+  ASSERT(i != m_submissions.end());
+  i->releases.push_back(std::move(release));
+}
+
+void Vulkan::submitBufferData(GpuBufferHandle bufferHandle, const void* data) {
+  submitBufferData(bufferHandle, data, 0, m_buffers[bufferHandle].size);
+}
+
+void Vulkan::submitBufferData(GpuBufferHandle bufferHandle, const void* data, size_t offset,
+  size_t size) {
+
+  uploadRegions(bufferHandle, static_cast<const char*>(data), {{ offset, size }}, offset);
+}
+
+void Vulkan::submitBufferRegions(GpuBufferHandle bufferHandle, const void* data,
+  const std::vector<GpuBufferRegion>& regions) {
+
+  uploadRegions(bufferHandle, static_cast<const char*>(data), regions, 0);
+}
+
+// Region offsets minus hostBase give the corresponding offsets in data
+void Vulkan::uploadRegions(GpuBufferHandle bufferHandle, const char* data,
+  const std::vector<GpuBufferRegion>& regions, size_t hostBase) {
+
+  Buffer& buffer = m_buffers[bufferHandle];
+
+  VkDeviceSize totalSize = regionsSize(buffer, regions);
+  if (totalSize == 0) {
+    return;
+  }
+
+  if (buffer.allocation.data != nullptr) {
+    // Writing now rather than in queue order, so earlier work using the buffer must finish first
+    waitForBufferIdle(buffer);
+
+    for (const GpuBufferRegion& region : regions) {
+      const char* src = data + region.offset - hostBase;
+      char* dst = buffer.allocation.data + region.offset;
+      if (src != dst) {
+        memcpy(dst, src, region.size);
+      }
+      m_allocator->flush(buffer.allocation, region.offset, region.size);
+    }
+
+    return;
+  }
+
+  // Regions are packed together in the staging buffer
+  VkDeviceSize stagingOffset = stageData(totalSize);
+  std::vector<VkBufferCopy> copies;
+
+  for (const GpuBufferRegion& region : regions) {
+    if (region.size == 0) {
+      continue;
+    }
+
+    memcpy(m_stagingBuffer.data + stagingOffset, data + region.offset - hostBase, region.size);
+
+    copies.push_back(VkBufferCopy{ stagingOffset, region.offset, region.size });
+    stagingOffset += region.size;
+  }
+
+  copyBuffer(m_stagingBuffer.handle, buffer.handle, copies);
+  buffer.lastUse = m_nextTicket;
+}
+
+void Vulkan::waitForBufferIdle(const Buffer& buffer) {
+  GpuTicket lastUse = std::max(buffer.lastUse, m_lastSequenceUse);
+
+  if (lastUse >= m_nextTicket) {
+    flushQueue();
+  }
+  else {
+    wait(lastUse);
+  }
+}
+
+// Integrated and software devices share memory with the host, so mapping their device-local
+// memory costs nothing. Discrete devices may expose host-visible VRAM too, but host reads from it
+// cross the bus uncached, so they keep using the staging buffer.
+bool Vulkan::supportsZeroCopy() const {
+  VkPhysicalDeviceType type = m_deviceProperties.deviceType;
+  if (type != VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU && type != VK_PHYSICAL_DEVICE_TYPE_CPU &&
+    type != VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU) {
+
+    return false;
+  }
+
+  const VkMemoryPropertyFlags required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+                                       | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+  const VkPhysicalDeviceMemoryProperties& memory = m_allocator->memoryProperties();
+  for (uint32_t i = 0; i < memory.memoryTypeCount; ++i) {
+    if ((memory.memoryTypes[i].propertyFlags & required) == required) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Whether compute shaders can use GL_KHR_shader_subgroup_arithmetic
+bool Vulkan::supportsSubgroupArithmetic() const {
+  if (m_deviceProperties.apiVersion < VK_API_VERSION_1_1) {
+    return false;
+  }
+
+  VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+  subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &subgroupProperties;
+
+  vkGetPhysicalDeviceProperties2(m_physicalDevice, &properties);
+
+  const VkSubgroupFeatureFlags required = VK_SUBGROUP_FEATURE_BASIC_BIT
+                                        | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+
+  return (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+    (subgroupProperties.supportedOperations & required) == required;
+}
+
+VkDeviceSize Vulkan::regionsSize(const Buffer& buffer,
+  const std::vector<GpuBufferRegion>& regions) const {
+
+  VkDeviceSize size = 0;
+  for (const GpuBufferRegion& region : regions) {
+    ASSERT_MSG(region.offset <= buffer.size && region.size <= buffer.size - region.offset,
+      "Region at offset " << region.offset << " of size " << region.size
+      << " exceeds buffer of size " << buffer.size);
+
+    size += region.size;
+  }
+
+  return size;
+}
+
+ShaderHandle Vulkan::compileShader(const std::string& sourcePath,
+  const GpuBufferBindings& bufferBindings, const Size3& workgroupSize) {
+
+  return compileShaders({ ShaderDesc{ sourcePath, bufferBindings, workgroupSize } })[0];
+}
+
+std::vector<ShaderHandle> Vulkan::compileShaders(const std::vector<ShaderDesc>& shaders) {
+  std::vector<Pipeline> pipelines(shaders.size());
+  std::vector<SpirvReflection> reflections(shaders.size());
+
+  // GLSL compilation and reflection are independent per shader and dominate the cost. Workers
+  // only live for the call, and a single shader is compiled on the calling thread.
+  size_t threads = std::min<size_t>(shaders.size(),
+    std::max(1u, std::thread::hardware_concurrency()));
+  WorkStealingPool pool(std::max<size_t>(threads, 1));
+
+  pool.parallelFor(shaders.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      pipelines[i].spirv = m_shaderCompiler.compile(shaders[i].sourcePath, shaders[i].source);
+      reflections[i] = reflectSpirv(pipelines[i].spirv);
+    }
+  });
+
+  std::vector<PipelineDesc> descs;
+
+  for (size_t i = 0; i < shaders.size(); ++i) {
+    const ShaderDesc& shader = shaders[i];
+    Pipeline& pipeline = pipelines[i];
+
+    pipeline.sourcePath = shader.sourcePath;
+    pipeline.workgroupSize = clampWorkgroupSize(shader.workgroupSize);
+    pipeline.specializationConstants = shader.specializationConstants;
+    for (size_t j = 0; j < 3; ++j) {
+      pipeline.elementsPerInvocation[j] = std::max(1u, shader.elementsPerInvocation[j]);
+    }
+    pipeline.bufferBindings = shader.bufferBindings;
+    pipeline.reflectedBuffers = reflections[i].buffers;
+    pipeline.pushConstantsSize = reflections[i].pushConstantsSize;
+
+    ASSERT_MSG(pipeline.pushConstantsSize <= m_deviceProperties.limits.maxPushConstantsSize,
+      "Push constant block of " << shader.sourcePath << " exceeds device limit of "
+      << m_deviceProperties.limits.maxPushConstantsSize << " bytes");
+
+    uint32_t storageBuffers = std::count_if(pipeline.reflectedBuffers.begin(),
+      pipeline.reflectedBuffers.end(), [](const SpirvBufferBinding& binding) {
+        return binding.type == SpirvBufferType::storage;
+      });
+    uint32_t uniformBuffers = pipeline.reflectedBuffers.size() - storageBuffers;
+
+    ASSERT_MSG(storageBuffers <= m_deviceProperties.limits.maxPerStageDescriptorStorageBuffers &&
+      uniformBuffers <= m_deviceProperties.limits.maxPerStageDescriptorUniformBuffers,
+      "Shader " << shader.sourcePath << " binds more buffers than the device allows per stage");
+
+    pipeline.descriptorSetLayout = descriptorSetLayout(pipeline.reflectedBuffers);
+    pipeline.layout = createPipelineLayout(pipeline.descriptorSetLayout,
+      pipeline.pushConstantsSize);
+
+    // Catch mismatched default bindings now rather than at first use
+    if (!pipeline.bufferBindings.empty()) {
+      descriptorSet(pipeline, pipeline.bufferBindings);
+    }
+
+    descs.push_back(PipelineDesc{ &pipeline.spirv, pipeline.layout, pipeline.workgroupSize,
+      pipeline.specializationConstants });
+  }
+
+  std::vector<VkPipeline> handles = createComputePipelines(descs);
+
+  std::vector<ShaderHandle> shaderHandles;
+  for (size_t i = 0; i < pipelines.size(); ++i) {
+    pipelines[i].handle = handles[i];
+    shaderHandles.push_back(m_pipelines.insert(std::move(pipelines[i])));
+  }
+
+  return shaderHandles;
+}
+
+VkPipeline Vulkan::createComputePipeline(const Pipeline& pipeline,
+  const Size3& workgroupSize) const {
+
+  return createComputePipelines({ PipelineDesc{ &pipeline.spirv, pipeline.layout, workgroupSize,
+    pipeline.specializationConstants } })[0];
+}
+
+std::vector<VkPipeline> Vulkan::createComputePipelines(
+  const std::vector<PipelineDesc>& descs) const {
+
+  // Constant i is the ith uint32 of the data, the workgroup size followed by any others
+  size_t maxConstants = 3;
+  for (const PipelineDesc& desc : descs) {
+    maxConstants = std::max(maxConstants, 3 + desc.specializationConstants.size());
+  }
+
+  std::vector<VkSpecializationMapEntry> entries;
+  for (uint32_t i = 0; i < maxConstants; ++i) {
+    entries.push_back(VkSpecializationMapEntry{
+      .constantID = i,
+      .offset = i * static_cast<uint32_t>(sizeof(uint32_t)),
+      .size = sizeof(uint32_t)
+    });
+  }
+
+  std::vector<VkShaderModule> shaderModules;
+  std::vector<std::vector<uint32_t>> specializationData;
+  std::vector<VkSpecializationInfo> specializationInfos;
+  std::vector<VkComputePipelineCreateInfo> pipelineInfos;
+
+  // Reserve so that pointers into these stay valid
+  specializationData.reserve(descs.size());
+  specializationInfos.reserve(descs.size());
+
+  for (const PipelineDesc& desc : descs) {
+    shaderModules.push_back(createShaderModule(*desc.spirv));
+
+    std::vector<uint32_t>& data = specializationData.emplace_back(desc.workgroupSize.begin(),
+      desc.workgroupSize.end());
+    data.insert(data.end(), desc.specializationConstants.begin(),
+      desc.specializationConstants.end());
+
+    specializationInfos.push_back(VkSpecializationInfo{
+      .mapEntryCount = static_cast<uint32_t>(data.size()),
+      .pMapEntries  = entries.data(),
+      .dataSize = data.size() * sizeof(uint32_t),
+      .pData = data.data()
+    });
+
+    VkPipelineShaderStageCreateInfo shaderStageInfo{};
+    shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shaderStageInfo.module = shaderModules.back();
+    shaderStageInfo.pName = "main";
+    shaderStageInfo.pSpecializationInfo = &specializationInfos.back();
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = desc.layout;
+    pipelineInfo.stage = shaderStageInfo;
+
+    pipelineInfos.push_back(pipelineInfo);
+  }
+
+  // A single call lets the driver compile the pipelines in parallel internally
+  std::vector<VkPipeline> pipelines(descs.size(), VK_NULL_HANDLE);
+  VkResult result = vkCreateComputePipelines(m_device, m_pipelineCache,
+    static_cast<uint32_t>(pipelineInfos.size()), pipelineInfos.data(), nullptr,
+    pipelines.data());
+
+  for (VkShaderModule shaderModule : shaderModules) {
+    vkDestroyShaderModule(m_device, shaderModule, nullptr);
+  }
+
+  VK_CHECK(result, "Failed to create compute pipelines");
+
+  return pipelines;
+}
+
+std::array<uint32_t, 3> Vulkan::clampWorkgroupSize(const Size3& workgroupSize) const {
+  const VkPhysicalDeviceLimits& limits = m_deviceProperties.limits;
+
+  std::array<uint32_t, 3> size;
+  for (size_t i = 0; i < 3; ++i) {
+    size[i] = std::max(1u, std::min(workgroupSize[i], limits.maxComputeWorkGroupSize[i]));
+  }
+
+  while (size[0] * size[1] * size[2] > limits.maxComputeWorkGroupInvocations) {
+    auto largest = std::max_element(size.begin(), size.end());
+    *largest = (*largest + 1) / 2;
+  }
+
+  return size;
+}
+
+std::array<uint32_t, 3> invocationCount(const Pipeline& pipeline, const Size3& problemSize) {
+  std::array<uint32_t, 3> count;
+  for (size_t i = 0; i < 3; ++i) {
+    count[i] = (problemSize[i] + pipeline.elementsPerInvocation[i] - 1)
+      / pipeline.elementsPerInvocation[i];
+  }
+
+  return count;
+}
+
+std::array<uint32_t, 3> Vulkan::workgroupCount(const Pipeline& pipeline,
+  const Size3& problemSize) const {
+
+  std::array<uint32_t, 3> invocations = invocationCount(pipeline, problemSize);
+
+  std::array<uint32_t, 3> count;
+  for (size_t i = 0; i < 3; ++i) {
+    count[i] = std::max(1u, (invocations[i] + pipeline.workgroupSize[i] - 1)
+      / pipeline.workgroupSize[i]);
+
+    ASSERT_MSG(count[i] <= m_deviceProperties.limits.maxComputeWorkGroupCount[i],
+      "Problem size " << problemSize[i] << " in dimension " << i << " needs " << count[i]
+      << " workgroups, exceeding the device limit of "
+      << m_deviceProperties.limits.maxComputeWorkGroupCount[i]);
+  }
+
+  return count;
+}
+
+void Vulkan::queueShader(ShaderHandle shaderHandle, const Size3& problemSize,
+  const void* pushConstants, size_t pushConstantsSize) {
+
+  queueShaderWithBindings(shaderHandle, m_pipelines[shaderHandle].bufferBindings, problemSize,
+    pushConstants, pushConstantsSize);
+}
+
+void Vulkan::queueShaderWithBindings(ShaderHandle shaderHandle,
+  const GpuBufferBindings& bufferBindings, const Size3& problemSize, const void* pushConstants,
+  size_t pushConstantsSize) {
+
+  VkCommandBuffer commandBuffer = currentCommandBuffer();
+  Pipeline& pipeline = m_pipelines[shaderHandle];
+
+  ASSERT_MSG(pushConstantsSize == pipeline.pushConstantsSize, "Shader " << pipeline.sourcePath
+    << " expects " << pipeline.pushConstantsSize << " bytes of push constants, got "
+    << pushConstantsSize);
+  ASSERT_MSG(pushConstantsSize == 0 || pushConstants != nullptr, "Push constants missing");
+
+  VkDescriptorSet set = descriptorSet(pipeline, bufferBindings);
+
+  std::vector<BufferAccess> accesses = shaderAccesses(pipeline, bufferBindings);
+  currentHazards().recordBarriers(commandBuffer, accesses);
+  if (!m_recordingSequence) {
+    trackQueueDependencies(ComputeQueue, accesses);
+
+    for (GpuBufferHandle handle : bufferBindings) {
+      m_buffers[handle].lastUse = m_nextTicket;
+    }
+    pipeline.lastUse = m_nextTicket;
+  }
+
+  TimedCommand timing;
+  timing.category = TimingCategory::shader;
+  timing.shader = shaderHandle;
+  bool timed = beginTiming(commandBuffer, ComputeQueue, timing);
+
+  dispatchWorkgroups(commandBuffer, shaderHandle, set, workgroupCount(pipeline, problemSize),
+    pushConstants);
+
+  if (timed) {
+    endTiming(commandBuffer, timing);
+  }
+}
+
+std::array<uint32_t, 3> Vulkan::tuneWorkgroupSize(ShaderHandle shaderHandle,
+  const Size3& problemSize, const void* pushConstants, size_t pushConstantsSize) {
+
+  ASSERT_MSG(!m_recordingSequence, "Can't tune shaders while recording a sequence");
+
+  Pipeline& pipeline = m_pipelines[shaderHandle];
+  std::string key = tuningKey(pipeline, problemSize);
+
+  auto cached = m_tunedWorkgroupSizes.find(key);
+  if (cached != m_tunedWorkgroupSizes.end()) {
+    if (cached->second != pipeline.workgroupSize) {
+      m_retiredPipelines.push_back(pipeline.handle);
+      pipeline.handle = createComputePipeline(pipeline, cached->second);
+      pipeline.workgroupSize = cached->second;
+    }
+    return cached->second;
+  }
+
+  const size_t repetitions = 8;
+
+  flushQueue();
+
+  VkPipeline originalHandle = pipeline.handle;
+  std::array<uint32_t, 3> originalSize = pipeline.workgroupSize;
+
+  VkPipeline bestHandle = VK_NULL_HANDLE;
+  std::array<uint32_t, 3> bestSize = originalSize;
+  double bestTime = 0;
+
+  for (const auto& candidate : workgroupSizeCandidates(invocationCount(pipeline, problemSize))) {
+    pipeline.handle = createComputePipeline(pipeline, candidate);
+    pipeline.workgroupSize = candidate;
+
+    // Warm up, so the first timed run doesn't include any lazy driver work
+    queueShader(shaderHandle, problemSize, pushConstants, pushConstantsSize);
+    flushQueue();
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < repetitions; ++i) {
+      queueShader(shaderHandle, problemSize, pushConstants, pushConstantsSize);
+    }
+    flushQueue();
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    double time = std::chrono::duration<double>(endTime - startTime).count();
+
+    if (bestHandle == VK_NULL_HANDLE || time < bestTime) {
+      if (bestHandle != VK_NULL_HANDLE) {
+        vkDestroyPipeline(m_device, bestHandle, nullptr);
+      }
+      bestHandle = pipeline.handle;
+      bestSize = candidate;
+      bestTime = time;
+    }
+    else {
+      vkDestroyPipeline(m_device, pipeline.handle, nullptr);
+    }
+  }
+
+  if (bestHandle == VK_NULL_HANDLE) {
+    pipeline.handle = originalHandle;
+    pipeline.workgroupSize = originalSize;
+    return originalSize;
+  }
+
+  m_retiredPipelines.push_back(originalHandle);
+  pipeline.handle = bestHandle;
+  pipeline.workgroupSize = bestSize;
+
+  m_tunedWorkgroupSizes[key] = bestSize;
+  saveTuningCache();
+
+  return bestSize;
+}
+
+std::vector<std::array<uint32_t, 3>> Vulkan::workgroupSizeCandidates(
+  const Size3& problemSize) const {
+
+  const VkPhysicalDeviceLimits& limits = m_deviceProperties.limits;
+  const uint32_t minInvocations = 32;
+
+  std::vector<std::array<uint32_t, 3>> candidates;
+
+  // Powers of two along each dimension the problem extends in, up to the problem size itself
+  std::array<std::vector<uint32_t>, 3> options;
+  for (size_t i = 0; i < 3; ++i) {
+    for (uint32_t n = 1; n <= limits.maxComputeWorkGroupSize[i]; n *= 2) {
+      options[i].push_back(n);
+      if (n >= problemSize[i]) {
+        break;
+      }
+    }
+  }
+
+  // In 64 bits, as large 2D and 3D problems overflow 32
+  uint64_t problemInvocations = uint64_t(problemSize[0]) * problemSize[1] * problemSize[2];
+
+  for (uint32_t x : options[0]) {
+    for (uint32_t y : options[1]) {
+      for (uint32_t z : options[2]) {
+        uint32_t invocations = x * y * z;
+
+        if (invocations > limits.maxComputeWorkGroupInvocations) {
+          continue;
+        }
+        if (invocations < std::min<uint64_t>(minInvocations, problemInvocations)) {
+          continue;
+        }
+
+        candidates.push_back({ x, y, z });
+      }
+    }
+  }
+
+  return candidates;
+}
+
+std::string Vulkan::tuningKey(const Pipeline& pipeline, const Size3& problemSize) const {
+  std::stringstream key;
+  key << std::hex << m_deviceProperties.vendorID << "-" << m_deviceProperties.deviceID << "-"
+    << m_deviceProperties.driverVersion << "-"
+    << hashBytes(pipeline.spirv.data(), pipeline.spirv.size() * sizeof(uint32_t)) << std::dec
+    << "-" << problemSize[0] << "x" << problemSize[1] << "x" << problemSize[2];
+
+  // Variants of a module built with different constants can want different sizes
+  const auto& elements = pipeline.elementsPerInvocation;
+  key << "-e" << elements[0] << "x" << elements[1] << "x" << elements[2] << "-c";
+  for (size_t i = 0; i < pipeline.specializationConstants.size(); ++i) {
+    key << (i > 0 ? "," : "") << pipeline.specializationConstants[i];
+  }
+
+  return key.str();
+}
+
+void Vulkan::loadTuningCache() {
+  std::ifstream stream(cacheDirectory() / "workgroup_sizes.txt");
+
+  std::string key;
+  std::array<uint32_t, 3> size;
+  while (stream >> key >> size[0] >> size[1] >> size[2]) {
+    m_tunedWorkgroupSizes[key] = clampWorkgroupSize(size);
+  }
+}
+
+void Vulkan::saveTuningCache() const {
+  std::ofstream stream(cacheDirectory() / "workgroup_sizes.txt");
+
+  for (const auto& entry : m_tunedWorkgroupSizes) {
+    const auto& size = entry.second;
+    stream << entry.first << " " << size[0] << " " << size[1] << " " << size[2] << std::endl;
+  }
+}
+
+void Vulkan::createPipelineCache() {
+  std::ifstream stream(cacheDirectory() / "pipeline_cache.bin", std::ios::binary | std::ios::ate);
+
+  std::vector<char> data;
+  if (stream.good()) {
+    data.resize(stream.tellg());
+    stream.seekg(0);
+    stream.read(data.data(), data.size());
+  }
+
+  // Data from another device or driver is at best ignored by the driver, so don't offer it
+  VkPipelineCacheHeaderVersionOne header{};
+  if (data.size() >= sizeof(header)) {
+    memcpy(&header, data.data(), sizeof(header));
+  }
+
+  bool valid = header.headerSize >= sizeof(header) &&
+    header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+    header.vendorID == m_deviceProperties.vendorID &&
+    header.deviceID == m_deviceProperties.deviceID &&
+    memcmp(header.pipelineCacheUUID, m_deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+  VkPipelineCacheCreateInfo cacheInfo{};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = valid ? data.size() : 0;
+  cacheInfo.pInitialData = valid ? data.data() : nullptr;
+
+  VK_CHECK(vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &m_pipelineCache),
+    "Failed to create pipeline cache");
+}
+
+void Vulkan::savePipelineCache() const {
+  size_t size = 0;
+  if (vkGetPipelineCacheData(m_device, m_pipelineCache, &size, nullptr) != VK_SUCCESS) {
+    return;
+  }
+
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(m_device, m_pipelineCache, &size, data.data()) != VK_SUCCESS) {
+    return;
+  }
+
+  writeFileAtomic(cacheDirectory() / "pipeline_cache.bin", data.data(), size);
+}
+
+std::vector<BufferAccess> Vulkan::shaderAccesses(const Pipeline& pipeline,
+  const GpuBufferBindings& bufferBindings) const {
+
+  std::vector<BufferAccess> accesses;
+
+  for (const SpirvBufferBinding& binding : pipeline.reflectedBuffers) {
+    const Buffer& buffer = m_buffers[bufferBindings[binding.binding]];
+
+    BufferAccess access;
+    access.buffer = buffer.handle;
+    access.stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    access.hostVisible = buffer.allocation.data != nullptr;
+    access.write = binding.writable;
+
+    if (binding.type == SpirvBufferType::uniform) {
+      access.access = VK_ACCESS_UNIFORM_READ_BIT;
+    }
+    else {
+      access.access = (binding.readable ? VK_ACCESS_SHADER_READ_BIT : 0)
+                    | (binding.writable ? VK_ACCESS_SHADER_WRITE_BIT : 0);
+    }
+
+    accesses.push_back(access);
+  }
+
+  return accesses;
+}
+
+VkCommandBuffer Vulkan::currentCommandBuffer(size_t queue) {
+  if (m_recordingSequence) {
+    return m_sequences.back();
+  }
+
+  if (m_batchCommandBuffer != VK_NULL_HANDLE && m_batchQueue != queue) {
+    endBatchCommandBuffer();
+  }
+
+  if (m_batchCommandBuffer == VK_NULL_HANDLE) {
+    m_batchCommandBuffer = createCommandBuffer(queue);
+    m_batchQueue = queue;
+    beginCommandBuffer(m_batchCommandBuffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    if (m_segments.empty() || m_segments.back().queue != queue) {
+      m_segments.push_back(Segment{ queue, m_nextSerial++, 0, {} });
+    }
+
+    if (queue == ComputeQueue && m_hazardsUnknown) {
+      m_queues[ComputeQueue].hazards.recordFullBarrier(m_batchCommandBuffer);
+      m_hazardsUnknown = false;
+    }
+  }
+
+  return m_batchCommandBuffer;
+}
+
+HazardTracker& Vulkan::currentHazards() {
+  return m_recordingSequence ? m_sequenceHazards : m_queues[ComputeQueue].hazards;
+}
+
+void Vulkan::endBatchCommandBuffer() {
+  if (m_batchCommandBuffer == VK_NULL_HANDLE) {
+    return;
+  }
+
+  Queue& queue = m_queues[m_batchQueue];
+
+  queue.hazards.recordHostBarrier(m_batchCommandBuffer);
+
+  VK_CHECK(vkEndCommandBuffer(m_batchCommandBuffer), "Failed to record command buffer");
+
+  m_segments.back().commandBuffers.push_back(m_batchCommandBuffer);
+  queue.transientCommandBuffers.push_back(m_batchCommandBuffer);
+  m_batchCommandBuffer = VK_NULL_HANDLE;
+}
+
+size_t Vulkan::transferQueue() const {
+  return m_separateTransferQueue ? TransferQueue : ComputeQueue;
+}
+
+void Vulkan::trackQueueDependencies(size_t queue, const std::vector<BufferAccess>& accesses) {
+  if (!m_separateTransferQueue) {
+    return;
+  }
+
+  Segment& segment = m_segments.back();
+  size_t other = 1 - queue;
+
+  for (const BufferAccess& access : accesses) {
+    BufferSerials& serials = m_bufferSerials[access.buffer];
+
+    uint64_t dependency = std::max(serials.write[other], m_unknownWriteSerial[other]);
+    if (access.write) {
+      dependency = std::max(dependency, serials.read[other]);
+    }
+    segment.waitSerial = std::max(segment.waitSerial, dependency);
+
+    if (access.write) {
+      serials.write[queue] = segment.serial;
+    }
+    else {
+      serials.read[queue] = segment.serial;
+    }
+  }
+}
+
+void Vulkan::beginSequence() {
+  ASSERT_MSG(!m_recordingSequence, "Already recording a sequence");
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = m_queues[ComputeQueue].commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = 1;
+
+  VkCommandBuffer commandBuffer;
+
+  VK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer),
+    "Failed to allocate command buffer");
+
+  // The same sequence may be queued several times before earlier submissions complete
+  beginCommandBuffer(commandBuffer, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
+
+  // A sequence can follow arbitrary work, including another run of itself
+  m_sequenceHazards.recordFullBarrier(commandBuffer);
+
+  m_sequences.push_back(commandBuffer);
+  m_recordingSequence = true;
+}
+
+GpuSequenceHandle Vulkan::endSequence() {
+  ASSERT_MSG(m_recordingSequence, "Not recording a sequence");
+
+  m_sequenceHazards.recordHostBarrier(m_sequences.back());
+
+  VK_CHECK(vkEndCommandBuffer(m_sequences.back()), "Failed to record command buffer");
+  m_recordingSequence = false;
+
+  return m_sequences.size() - 1;
+}
+
+void Vulkan::queueSequence(GpuSequenceHandle sequence) {
+  ASSERT_MSG(!m_recordingSequence, "Sequences can't be nested");
+  ASSERT_MSG(sequence < m_sequences.size(), "No sequence with handle " << sequence);
+
+  endBatchCommandBuffer();
+
+  if (m_segments.empty() || m_segments.back().queue != ComputeQueue) {
+    m_segments.push_back(Segment{ ComputeQueue, m_nextSerial++, 0, {} });
+  }
+
+  Segment& segment = m_segments.back();
+  segment.commandBuffers.push_back(m_sequences[sequence]);
+
+  // The sequence's buffers aren't tracked, so order it against everything on the other queue
+  if (m_separateTransferQueue) {
+    segment.waitSerial = segment.serial;
+    m_unknownWriteSerial[ComputeQueue] = segment.serial;
+  }
+
+  m_hazardsUnknown = true;
+  m_lastSequenceUse = m_nextTicket;
+}
+
+void Vulkan::flushQueue() {
+  wait(flushQueueAsync());
+}
+
+GpuTicket Vulkan::flushQueueAsync() {
+  endBatchCommandBuffer();
+
+  if (m_segments.empty()) {
+    for (auto& release : m_batchReleases) {
+      releaseAfter(m_nextTicket - 1, std::move(release));
+    }
+    m_batchReleases.clear();
+
+    return m_nextTicket - 1;
+  }
+
+  Submission submission;
+  submission.ticket = m_nextTicket++;
+
+  // Each queue's fence goes on its last submission of the batch
+  std::array<size_t, 2> lastSegment{ m_segments.size(), m_segments.size() };
+  for (size_t i = 0; i < m_segments.size(); ++i) {
+    lastSegment[m_segments[i].queue] = i;
+  }
+
+  for (size_t i = 0; i < m_segments.size(); ++i) {
+    const Segment& segment = m_segments[i];
+    Queue& queue = m_queues[segment.queue];
+    size_t other = 1 - segment.queue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = segment.commandBuffers.size();
+    submitInfo.pCommandBuffers = segment.commandBuffers.data();
+
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    VkPipelineStageFlags waitStage = segment.queue == ComputeQueue ?
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    if (segment.waitSerial > queue.waitedSerial &&
+      m_queues[other].submittedSerial > queue.waitedSerial) {
+
+      semaphore = signalSemaphore(other);
+      submission.semaphores.push_back(semaphore);
+      queue.waitedSerial = m_queues[other].submittedSerial;
+
+      submitInfo.waitSemaphoreCount = 1;
+      submitInfo.pWaitSemaphores = &semaphore;
+      submitInfo.pWaitDstStageMask = &waitStage;
+    }
+
+    VkFence fence = VK_NULL_HANDLE;
+    if (i == lastSegment[segment.queue]) {
+      fence = acquireFence();
+      submission.fences[segment.queue] = fence;
+    }
+
+    VK_CHECK(vkQueueSubmit(queue.handle, 1, &submitInfo, fence),
+      "Failed to submit command buffers");
+
+    queue.submittedSerial = segment.serial;
+  }
+
+  m_segments.clear();
+
+  for (size_t i = 0; i < m_queues.size(); ++i) {
+    submission.transientCommandBuffers[i] = std::move(m_queues[i].transientCommandBuffers);
+    m_queues[i].transientCommandBuffers.clear();
+  }
+
+  for (auto& region : m_stagingBuffer.regions) {
+    if (region.ticket == 0) {
+      region.ticket = submission.ticket;
+    }
+  }
+
+  submission.releases = std::move(m_batchReleases);
+  m_batchReleases.clear();
+
+  submission.timedCommands = std::move(m_batchTimedCommands);
+  m_batchTimedCommands.clear();
+  submission.queryPools = std::move(m_batchQueryPools);
+  m_batchQueryPools.clear();
+  m_nextQuery = QueriesPerPool;
+
+  GpuTicket ticket = submission.ticket;
+  m_submissions.push_back(std::move(submission));
+
+  retireSubmissions();
+
+  return ticket;
+}
+
+// Signals a semaphore once all work submitted so far to the queue has completed
+VkSemaphore Vulkan::signalSemaphore(size_t queue) {
+  VkSemaphore semaphore = acquireSemaphore();
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &semaphore;
+
+  VK_CHECK(vkQueueSubmit(m_queues[queue].handle, 1, &submitInfo, VK_NULL_HANDLE),
+    "Failed to submit semaphore signal");
+
+  return semaphore;
+}
+
+bool Vulkan::isComplete(GpuTicket ticket) {
+  retireSubmissions();
+  return m_submissions.empty() || m_submissions.front().ticket > ticket;
+}
+
+void Vulkan::wait(GpuTicket ticket) {
+  ASSERT_MSG(ticket < m_nextTicket, "Ticket " << ticket << " has not been issued");
+
+  while (!m_submissions.empty() && m_submissions.front().ticket <= ticket) {
+    for (VkFence fence : m_submissions.front().fences) {
+      if (fence != VK_NULL_HANDLE) {
+        VK_CHECK(vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX),
+          "Error waiting for fence");
+      }
+    }
+
+    retireOldestSubmission();
+  }
+}
+
+void Vulkan::onComplete(GpuTicket ticket, std::function<void()> callback) {
+  ASSERT_MSG(ticket < m_nextTicket, "Ticket " << ticket << " has not been issued");
+
+  if (isComplete(ticket)) {
+    callback();
+    return;
+  }
+
+  auto i = std::find_if(m_submissions.begin(), m_submissions.end(),
+    [ticket](const Submission& submission) { return submission.ticket == ticket; });
+
+  ASSERT(i != m_submissions.end());
+  i->callbacks.push_back(std::move(callback));
+}
+
+VkFence Vulkan::acquireFence() {
+  if (!m_freeFences.empty()) {
+    VkFence fence = m_freeFences.back();
+    m_freeFences.pop_back();
+    return fence;
+  }
+
+  VkFenceCreateInfo fenceInfo{};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fenceInfo.flags = 0;
+
+  VkFence fence;
+  VK_CHECK(vkCreateFence(m_device, &fenceInfo, nullptr, &fence), "Failed to create fence");
+
+  return fence;
+}
+
+VkSemaphore Vulkan::acquireSemaphore() {
+  if (!m_freeSemaphores.empty()) {
+    VkSemaphore semaphore = m_freeSemaphores.back();
+    m_freeSemaphores.pop_back();
+    return semaphore;
+  }
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  VkSemaphore semaphore;
+  VK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &semaphore),
+    "Failed to create semaphore");
+
+  return semaphore;
+}
+
+// Pools are only recycled once the work using them has completed, so they can be reset on the host
+VkQueryPool Vulkan::acquireQueryPool() {
+  VkQueryPool pool;
+
+  if (!m_freeQueryPools.empty()) {
+    pool = m_freeQueryPools.back();
+    m_freeQueryPools.pop_back();
+  }
+  else {
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = QueriesPerPool;
+
+    VK_CHECK(vkCreateQueryPool(m_device, &poolInfo, nullptr, &pool),
+      "Failed to create query pool");
+  }
+
+  if (m_resetQueryPool != nullptr) {
+    m_resetQueryPool(m_device, pool, 0, QueriesPerPool);
+  }
+
+  return pool;
+}
+
+void Vulkan::setProfilingEnabled(bool enabled) {
+  m_profiling = enabled;
+}
+
+// Returns false if the command can't be timed, in which case endTiming() mustn't be called
+bool Vulkan::beginTiming(VkCommandBuffer commandBuffer, size_t queue, TimedCommand& command) {
+  // Sequences may be queued many times, but each query can only be written once per reset
+  if (!m_profiling || m_recordingSequence || m_queues[queue].timestampMask == 0) {
+    return false;
+  }
+  // Without host resets, copies on a transfer-only queue go untimed
+  if (m_resetQueryPool == nullptr && !m_queues[queue].resetsQueries) {
+    return false;
+  }
+
+  if (m_nextQuery + 2 > QueriesPerPool) {
+    m_batchQueryPools.push_back(acquireQueryPool());
+    m_nextQuery = 0;
+  }
+
+  command.pool = m_batchQueryPools.back();
+  command.query = m_nextQuery;
+  command.queue = queue;
+  m_nextQuery += 2;
+
+  // Bottom of pipe on both sides, so the time runs from when earlier commands finish until this
+  // one does and overlapping work isn't counted twice
+  if (m_resetQueryPool == nullptr) {
+    vkCmdResetQueryPool(commandBuffer, command.pool, command.query, 2);
+  }
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, command.pool,
+    command.query);
+
+  return true;
+}
+
+void Vulkan::endTiming(VkCommandBuffer commandBuffer, const TimedCommand& command) {
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, command.pool,
+    command.query + 1);
+
+  m_batchTimedCommands.push_back(command);
+}
+
+void Vulkan::collectTimings(const Submission& submission) {
+  for (const TimedCommand& command : submission.timedCommands) {
+    uint64_t timestamps[2];
+    VK_CHECK(vkGetQueryPoolResults(m_device, command.pool, command.query, 2, sizeof(timestamps),
+      timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT),
+      "Failed to get timestamp query results");
+
+    uint64_t ticks = (timestamps[1] - timestamps[0]) & m_queues[command.queue].timestampMask;
+    double microseconds = ticks * m_deviceProperties.limits.timestampPeriod / 1000.0;
+
+    switch (command.category) {
+      case TimingCategory::shader:
+        m_shaderTimings[command.shader].push_back(microseconds);
+        break;
+      case TimingCategory::upload:
+        m_uploadTimings.push_back(microseconds);
+        break;
+      case TimingCategory::download:
+        m_downloadTimings.push_back(microseconds);
+        break;
+    }
+  }
+}
+
+GpuProfile Vulkan::profile() {
+  retireSubmissions();
+
+  GpuProfile profile;
+  for (const auto& entry : m_shaderTimings) {
+    profile.shaders[entry.first] = timingStats(entry.second);
+  }
+  profile.uploads = timingStats(m_uploadTimings);
+  profile.downloads = timingStats(m_downloadTimings);
+
+  return profile;
+}
+
+void Vulkan::resetProfile() {
+  m_shaderTimings.clear();
+  m_uploadTimings.clear();
+  m_downloadTimings.clear();
+}
+
+void Vulkan::retireSubmissions() {
+  while (!m_submissions.empty()) {
+    for (VkFence fence : m_submissions.front().fences) {
+      if (fence == VK_NULL_HANDLE) {
+        continue;
+      }
+
+      VkResult status = vkGetFenceStatus(m_device, fence);
+      if (status == VK_NOT_READY) {
+        return;
       }
-      memProps = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+      VK_CHECK(status, "Error querying fence status");
     }
+
+    retireOldestSubmission();
   }
 }
 
-GpuBuffer Vulkan::allocateBuffer(size_t size, GpuBufferFlags flags) {
-  Buffer buffer;
-  buffer.size = size;
+void Vulkan::retireOldestSubmission() {
+  Submission submission = std::move(m_submissions.front());
+  m_submissions.pop_front();
 
-  VkMemoryPropertyFlags memProps = 0;
-  VkBufferUsageFlags usage = 0;
-  bool memoryMapped = false;
+  for (VkFence fence : submission.fences) {
+    if (fence != VK_NULL_HANDLE) {
+      VK_CHECK(vkResetFences(m_device, 1, &fence), "Error resetting fence");
+      m_freeFences.push_back(fence);
+    }
+  }
 
-  chooseVulkanBufferFlags(flags, memProps, usage, buffer.type, memoryMapped);
+  collectTimings(submission);
+  m_freeQueryPools.insert(m_freeQueryPools.end(), submission.queryPools.begin(),
+    submission.queryPools.end());
 
-  GpuBuffer gpuBuffer;
+  // Waits on these completed before the fences signalled
+  m_freeSemaphores.insert(m_freeSemaphores.end(), submission.semaphores.begin(),
+    submission.semaphores.end());
 
-  createBuffer(size, usage, memProps, buffer.handle, buffer.memory);
-  if (memoryMapped) {
-    vkMapMemory(m_device, buffer.memory, 0, buffer.size, 0, &gpuBuffer.data);
+  for (size_t i = 0; i < m_queues.size(); ++i) {
+    auto& commandBuffers = submission.transientCommandBuffers[i];
+    m_queues[i].freeCommandBuffers.insert(m_queues[i].freeCommandBuffers.end(),
+      commandBuffers.begin(), commandBuffers.end());
   }
 
-  m_buffers.push_back(buffer);
+  for (auto& release : submission.releases) {
+    release();
+  }
 
-  // TODO: Can't just be an index if we allow buffer deletion
-  gpuBuffer.handle = m_buffers.size() - 1;
+  // After the releases, which may copy out downloads still in the staging buffer
+  auto& regions = m_stagingBuffer.regions;
+  while (!regions.empty() && regions.front().ticket != 0 &&
+    regions.front().ticket <= submission.ticket) {
 
-  return gpuBuffer;
+    regions.pop_front();
+  }
+
+  for (auto& callback : submission.callbacks) {
+    callback();
+  }
 }
 
-void Vulkan::submitBufferData(GpuBufferHandle bufferHandle, const void* data) {
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
+void Vulkan::retrieveBuffer(GpuBufferHandle bufIdx, void* data) {
+  retrieveBuffer(bufIdx, data, 0, m_buffers[bufIdx].size);
+}
 
-  Buffer& buffer = m_buffers[bufferHandle];
+void Vulkan::retrieveBuffer(GpuBufferHandle bufIdx, void* data, size_t offset, size_t size) {
+  downloadRegions(bufIdx, static_cast<char*>(data), {{ offset, size }}, offset);
+}
 
-  VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-                              | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+void Vulkan::retrieveBufferRegions(GpuBufferHandle bufIdx, void* data,
+  const std::vector<GpuBufferRegion>& regions) {
 
-  VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-                                  | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-  createBuffer(buffer.size, stagingUsage, flags, stagingBuffer, stagingBufferMemory);
+  downloadRegions(bufIdx, static_cast<char*>(data), regions, 0);
+}
 
-  void* stagingBufferMapped = nullptr;
-  vkMapMemory(m_device, stagingBufferMemory, 0, buffer.size, 0, &stagingBufferMapped);
-  memcpy(stagingBufferMapped, data, buffer.size);
-  vkUnmapMemory(m_device, stagingBufferMemory);
+void Vulkan::downloadRegions(GpuBufferHandle bufIdx, char* data,
+  const std::vector<GpuBufferRegion>& regions, size_t hostBase) {
 
-  copyBuffer(stagingBuffer, buffer.handle, buffer.size);
-  flushQueue();
+  const Buffer& buffer = m_buffers[bufIdx];
 
-  vkFreeMemory(m_device, stagingBufferMemory, nullptr);
-  vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-}
+  VkDeviceSize totalSize = regionsSize(buffer, regions);
+  if (totalSize == 0) {
+    return;
+  }
 
-ShaderHandle Vulkan::compileShader(const std::string& sourcePath,
-  const GpuBufferBindings& bufferBindings, const Size3& workgroupSize) {
+  if (buffer.allocation.data != nullptr) {
+    waitForBufferIdle(buffer);
 
-  VkShaderModule shaderModule = createShaderModule(sourcePath);
+    for (const GpuBufferRegion& region : regions) {
+      m_allocator->invalidate(buffer.allocation, region.offset, region.size);
 
-  const VkSpecializationMapEntry entries[] = {
-    {
-      .constantID = 0,
-      .offset = 0 * sizeof(uint32_t),
-      .size = sizeof(uint32_t)
-    },
-    {
-      .constantID = 1,
-      .offset = 1 * sizeof(uint32_t),
-      .size = sizeof(uint32_t)
-    },
-    {
-      .constantID = 2,
-      .offset = 2 * sizeof(uint32_t),
-      .size = sizeof(uint32_t)
+      const char* src = buffer.allocation.data + region.offset;
+      char* dst = data + region.offset - hostBase;
+      if (src != dst) {
+        memcpy(dst, src, region.size);
+      }
     }
-  };
-
-  const VkSpecializationInfo specializationInfo = {
-    .mapEntryCount = 3,
-    .pMapEntries  = entries,
-    .dataSize = 3 * sizeof(uint32_t),
-    .pData = workgroupSize.data()
-  };
 
-  Pipeline pipeline;
-  pipeline.descriptorSetLayout = createDescriptorSetLayout(bufferBindings);
-  pipeline.layout = createPipelineLayout(pipeline.descriptorSetLayout);
+    return;
+  }
 
-  VkPipelineShaderStageCreateInfo shaderStageInfo{};
-  shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  shaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-  shaderStageInfo.module = shaderModule;
-  shaderStageInfo.pName = "main";
-  shaderStageInfo.pSpecializationInfo = &specializationInfo;
+  VkDeviceSize stagingOffset = stageData(totalSize);
+  std::vector<VkBufferCopy> copies;
 
-  VkComputePipelineCreateInfo pipelineInfo{};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-  pipelineInfo.layout = pipeline.layout;
-  pipelineInfo.stage = shaderStageInfo;
+  for (const GpuBufferRegion& region : regions) {
+    if (region.size > 0) {
+      copies.push_back(VkBufferCopy{ region.offset, stagingOffset, region.size });
+      stagingOffset += region.size;
+    }
+  }
 
-  VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
-    &pipeline.handle), "Failed to create compute pipeline");
+  copyBuffer(buffer.handle, m_stagingBuffer.handle, copies);
+  flushQueue();
 
-  vkDestroyShaderModule(m_device, shaderModule, nullptr);
+  for (const VkBufferCopy& copy : copies) {
+    memcpy(data + copy.srcOffset - hostBase, m_stagingBuffer.data + copy.dstOffset, copy.size);
+  }
+}
 
-  pipeline.descriptorSet = createDescriptorSet(bufferBindings, pipeline.descriptorSetLayout);
+void Vulkan::retrieveBufferAsync(GpuBufferHandle bufIdx, void* data, size_t offset,
+  size_t size) {
 
-  m_pipelines.push_back(pipeline);
+  Buffer& buffer = m_buffers[bufIdx];
 
-  return m_pipelines.size() - 1;
-}
+  if (regionsSize(buffer, {{ offset, size }}) == 0) {
+    return;
+  }
 
-void Vulkan::queueShader(ShaderHandle shaderHandle) {
-  VkCommandBuffer commandBuffer = createCommandBuffer();
-  m_commandBuffers.push_back(commandBuffer);
+  char* dst = static_cast<char*>(data);
 
-  dispatchWorkgroups(commandBuffer, shaderHandle, { 1, 1, 1 }); // TODO
-}
+  // Mapped memory is only read directly when no work uses the buffer. A deferred read would see
+  // writes queued after this call, or race with later batches, so otherwise it goes through the
+  // staging buffer in queue order, like any other read.
+  GpuTicket lastUse = std::max(buffer.lastUse, m_lastSequenceUse);
+  if (buffer.allocation.data != nullptr && lastUse < m_nextTicket && isComplete(lastUse)) {
+    m_allocator->invalidate(buffer.allocation, offset, size);
+    if (buffer.allocation.data + offset != dst) {
+      memcpy(dst, buffer.allocation.data + offset, size);
+    }
 
-void Vulkan::flushQueue() {
-  if (m_commandBuffers.empty()) {
     return;
   }
 
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = m_commandBuffers.size();
-  submitInfo.pCommandBuffers = m_commandBuffers.data();
+  VkDeviceSize stagingOffset = stageData(size);
+
+  copyBuffer(buffer.handle, m_stagingBuffer.handle, {{ offset, stagingOffset, size }});
+  buffer.lastUse = m_nextTicket;
 
-  VK_CHECK(vkQueueSubmit(m_computeQueue, 1, &submitInfo, m_taskCompleteFence),
-    "Failed to submit compute command buffer");
+  releaseAfter(m_nextTicket, [this, dst, stagingOffset, size]() {
+    memcpy(dst, m_stagingBuffer.data + stagingOffset, size);
+  });
+}
+
+VkDeviceSize Vulkan::stageData(VkDeviceSize size) {
+  if (size > m_stagingBuffer.size) {
+    flushQueue();
+
+    VkDeviceSize newSize = m_stagingBuffer.size;
+    while (newSize < size) {
+      newSize *= 2;
+    }
 
-  // TODO: Remove fences?
+    destroyStagingBuffer();
+    createStagingBuffer(newSize);
+  }
+
+  VkDeviceSize offset = 0;
+  while (!findStagingSpace(size, offset)) {
+    // Space is held by copies that haven't been submitted yet
+    if (m_submissions.empty()) {
+      flushQueueAsync();
+    }
+    ASSERT_MSG(!m_submissions.empty(), "Staging buffer space held by unsubmitted work");
 
-  VK_CHECK(vkWaitForFences(m_device, 1, &m_taskCompleteFence, VK_TRUE, UINT64_MAX),
-    "Error waiting for fence");
+    wait(m_submissions.front().ticket);
+  }
 
-  VK_CHECK(vkResetFences(m_device, 1, &m_taskCompleteFence), "Error resetting fence");
+  m_stagingBuffer.regions.push_back(StagingRegion{ offset, offset + size, 0 });
 
-  vkFreeCommandBuffers(m_device, m_commandPool, m_commandBuffers.size(), m_commandBuffers.data());
-  m_commandBuffers.clear();
+  return offset;
 }
 
-void Vulkan::retrieveBuffer(GpuBufferHandle bufIdx, void* data) {
-  Buffer& buffer = m_buffers[bufIdx];
+bool Vulkan::findStagingSpace(VkDeviceSize size, VkDeviceSize& offset) const {
+  const auto& regions = m_stagingBuffer.regions;
+
+  if (regions.empty()) {
+    offset = 0;
+    return true;
+  }
+
+  VkDeviceSize alignment = std::max<VkDeviceSize>(
+    m_deviceProperties.limits.optimalBufferCopyOffsetAlignment, 4);
+
+  VkDeviceSize first = regions.front().begin;
+  const StagingRegion& last = regions.back();
+  VkDeviceSize next = alignUp(last.end, alignment);
+
+  bool wrapped = last.begin < first;
+
+  if (wrapped) {
+    if (next + size <= first) {
+      offset = next;
+      return true;
+    }
+    return false;
+  }
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
+  if (next + size <= m_stagingBuffer.size) {
+    offset = next;
+    return true;
+  }
+  if (size <= first) {
+    offset = 0;
+    return true;
+  }
+  return false;
+}
 
+void Vulkan::createStagingBuffer(VkDeviceSize size) {
   VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
                               | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
                               | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
 
   VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
                                   | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-  createBuffer(buffer.size, stagingUsage, flags, stagingBuffer, stagingBufferMemory);
 
-  copyBuffer(buffer.handle, stagingBuffer, buffer.size);
-  flushQueue();
+  createBuffer(size, stagingUsage, flags, m_stagingBuffer.handle, m_stagingBuffer.allocation);
 
-  void* stagingBufferMapped = nullptr;
-  vkMapMemory(m_device, stagingBufferMemory, 0, buffer.size, 0, &stagingBufferMapped);
-  memcpy(data, stagingBufferMapped, buffer.size);
-  vkUnmapMemory(m_device, stagingBufferMemory);
+  m_stagingBuffer.data = m_stagingBuffer.allocation.data;
+  m_stagingBuffer.size = size;
+}
 
-  vkFreeMemory(m_device, stagingBufferMemory, nullptr);
-  vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+void Vulkan::destroyStagingBuffer() {
+  vkDestroyBuffer(m_device, m_stagingBuffer.handle, nullptr);
+  m_allocator->free(m_stagingBuffer.allocation);
+  m_stagingBuffer = StagingBuffer{};
 }
 
 void checkValidationLayerSupport() {
@@ -408,6 +1775,19 @@ std::vector<const char*> getRequiredExtensions() {
   return extensions;
 }
 
+bool hasDeviceExtension(VkPhysicalDevice physicalDevice, const char* name) {
+  uint32_t count = 0;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, nullptr);
+
+  std::vector<VkExtensionProperties> extensions(count);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, extensions.data());
+
+  return std::any_of(extensions.begin(), extensions.end(),
+    [name](const VkExtensionProperties& extension) {
+      return strcmp(extension.extensionName, name) == 0;
+    });
+}
+
 void Vulkan::setupDebugMessenger() {
   auto createInfo = getDebugMessengerCreateInfo();
 
@@ -434,6 +1814,8 @@ void Vulkan::pickPhysicalDevice() {
     "Failed to enumerate physical devices");
 
   m_physicalDevice = devices[0];
+
+  vkGetPhysicalDeviceProperties(m_physicalDevice, &m_deviceProperties);
 }
 
 uint32_t Vulkan::findComputeQueueFamily() const {
@@ -453,23 +1835,138 @@ uint32_t Vulkan::findComputeQueueFamily() const {
   EXCEPTION("Could not find compute queue family");
 }
 
+// Finds a queue for transfers other than the compute queue, preferring a transfer-only family
+// (typically a DMA engine), then another family, then a second queue in the compute family
+bool Vulkan::findTransferQueue(uint32_t computeFamily, uint32_t& family, uint32_t& index) const {
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount, nullptr);
+
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount,
+    queueFamilies.data());
+
+  const VkQueueFlags computeOrGraphics = VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT;
+
+  for (uint32_t i = 0; i < queueFamilies.size(); ++i) {
+    VkQueueFlags flags = queueFamilies[i].queueFlags;
+    if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & computeOrGraphics)) {
+      family = i;
+      index = 0;
+      return true;
+    }
+  }
+
+  // Compute and graphics queues support transfers even if they don't advertise it
+  for (uint32_t i = 0; i < queueFamilies.size(); ++i) {
+    VkQueueFlags flags = queueFamilies[i].queueFlags;
+    if (i != computeFamily && (flags & (computeOrGraphics | VK_QUEUE_TRANSFER_BIT))) {
+      family = i;
+      index = 0;
+      return true;
+    }
+  }
+
+  if (queueFamilies[computeFamily].queueCount > 1) {
+    family = computeFamily;
+    index = 1;
+    return true;
+  }
+
+  return false;
+}
+
 void Vulkan::createLogicalDevice() {
-  VkDeviceQueueCreateInfo queueCreateInfo{};
+  Queue& computeQueue = m_queues[ComputeQueue];
+  Queue& transferQueue = m_queues[TransferQueue];
+
+  computeQueue.family = findComputeQueueFamily();
+
+  uint32_t transferIndex = 0;
+  m_separateTransferQueue = findTransferQueue(computeQueue.family, transferQueue.family,
+    transferIndex);
+
+  const float queuePriorities[] = { 1, 1 };
 
+  std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+
+  VkDeviceQueueCreateInfo queueCreateInfo{};
   queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-  queueCreateInfo.queueFamilyIndex = findComputeQueueFamily();
+  queueCreateInfo.queueFamilyIndex = computeQueue.family;
   queueCreateInfo.queueCount = 1;
-  float queuePriority = 1;
-  queueCreateInfo.pQueuePriorities = &queuePriority;
+  queueCreateInfo.pQueuePriorities = queuePriorities;
+  queueCreateInfos.push_back(queueCreateInfo);
+
+  if (m_separateTransferQueue) {
+    if (transferQueue.family == computeQueue.family) {
+      queueCreateInfos.back().queueCount = 2;
+    }
+    else {
+      queueCreateInfo.queueFamilyIndex = transferQueue.family;
+      queueCreateInfos.push_back(queueCreateInfo);
+    }
+  }
 
   VkPhysicalDeviceFeatures deviceFeatures{};
 
+  // 16-bit netfloat_t buffers are read and written directly where the device allows it, and
+  // otherwise as pairs packed into 32-bit words
+  VkPhysicalDevice16BitStorageFeatures storage16BitFeatures{};
+  storage16BitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES;
+
+  // Timestamp queries are reset on the host where possible, since transfer-only queues can't
+  // reset them in command buffers
+  VkPhysicalDeviceHostQueryResetFeaturesEXT hostQueryResetFeatures{};
+  hostQueryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT;
+
+  bool hostQueryResetExtension = hasDeviceExtension(m_physicalDevice,
+    VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+
+  if (m_deviceProperties.apiVersion >= VK_API_VERSION_1_1) {
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &storage16BitFeatures;
+    if (hostQueryResetExtension) {
+      storage16BitFeatures.pNext = &hostQueryResetFeatures;
+    }
+
+    vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features);
+  }
+
+#if defined(NETFLOAT_FP16) || defined(NETFLOAT_BF16)
+  m_16BitStorage = storage16BitFeatures.storageBuffer16BitAccess == VK_TRUE;
+#endif
+  bool hostQueryReset = hostQueryResetFeatures.hostQueryReset == VK_TRUE;
+
+  void* enabledFeatures = nullptr;
+  std::vector<const char*> extensions;
+
+  VkPhysicalDevice16BitStorageFeatures enabled16BitFeatures{};
+  enabled16BitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES;
+  enabled16BitFeatures.storageBuffer16BitAccess = VK_TRUE;
+
+  if (m_16BitStorage) {
+    enabled16BitFeatures.pNext = enabledFeatures;
+    enabledFeatures = &enabled16BitFeatures;
+  }
+
+  VkPhysicalDeviceHostQueryResetFeaturesEXT enabledHostQueryReset{};
+  enabledHostQueryReset.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT;
+  enabledHostQueryReset.hostQueryReset = VK_TRUE;
+
+  if (hostQueryReset) {
+    enabledHostQueryReset.pNext = enabledFeatures;
+    enabledFeatures = &enabledHostQueryReset;
+    extensions.push_back(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+  }
+
   VkDeviceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  createInfo.queueCreateInfoCount = 1;
-  createInfo.pQueueCreateInfos = &queueCreateInfo;
+  createInfo.pNext = enabledFeatures;
+  createInfo.queueCreateInfoCount = queueCreateInfos.size();
+  createInfo.pQueueCreateInfos = queueCreateInfos.data();
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount = 0;
+  createInfo.enabledExtensionCount = extensions.size();
+  createInfo.ppEnabledExtensionNames = extensions.data();
 
 #ifdef NDEBUG
   createInfo.enabledLayerCount = 0;
@@ -481,31 +1978,71 @@ void Vulkan::createLogicalDevice() {
   VK_CHECK(vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device),
     "Failed to create logical device");
 
-  vkGetDeviceQueue(m_device, queueCreateInfo.queueFamilyIndex, 0, &m_computeQueue);
+  vkGetDeviceQueue(m_device, computeQueue.family, 0, &computeQueue.handle);
+
+  if (hostQueryReset) {
+    m_resetQueryPool = reinterpret_cast<PFN_vkResetQueryPoolEXT>(
+      vkGetDeviceProcAddr(m_device, "vkResetQueryPoolEXT"));
+  }
+
+  if (m_separateTransferQueue) {
+    vkGetDeviceQueue(m_device, transferQueue.family, transferIndex, &transferQueue.handle);
+  }
+
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount, nullptr);
+
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount,
+    queueFamilies.data());
+
+  for (Queue& queue : m_queues) {
+    uint32_t validBits = queueFamilies[queue.family].timestampValidBits;
+    queue.timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    queue.resetsQueries = queueFamilies[queue.family].queueFlags
+      & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT);
+  }
 }
 
-void Vulkan::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-  VkCommandBuffer commandBuffer = createCommandBuffer();
+void Vulkan::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
+  const std::vector<VkBufferCopy>& regions) {
 
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  ASSERT_MSG(!m_recordingSequence, "Transfers can't be recorded into a sequence");
+
+  size_t queue = transferQueue();
+  VkCommandBuffer commandBuffer = currentCommandBuffer(queue);
+
+  BufferAccess src;
+  src.buffer = srcBuffer;
+  src.stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  src.access = VK_ACCESS_TRANSFER_READ_BIT;
+  src.write = false;
+  src.hostVisible = srcBuffer == m_stagingBuffer.handle;
 
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  BufferAccess dst;
+  dst.buffer = dstBuffer;
+  dst.stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dst.access = VK_ACCESS_TRANSFER_WRITE_BIT;
+  dst.write = true;
+  dst.hostVisible = dstBuffer == m_stagingBuffer.handle;
 
-  VkBufferCopy copyRegion{};
-  copyRegion.srcOffset = 0;
-  copyRegion.dstOffset = 0;
-  copyRegion.size = size;
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+  m_queues[queue].hazards.recordBarriers(commandBuffer, { src, dst });
+  trackQueueDependencies(queue, { src, dst });
 
-  vkEndCommandBuffer(commandBuffer);
+  TimedCommand timing;
+  timing.category = dst.hostVisible ? TimingCategory::download : TimingCategory::upload;
+  bool timed = beginTiming(commandBuffer, queue, timing);
 
-  m_commandBuffers.push_back(commandBuffer);
+  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, regions.size(), regions.data());
+
+  if (timed) {
+    endTiming(commandBuffer, timing);
+  }
 }
 
 void Vulkan::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-  VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) const {
+  VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& allocation,
+  VkMemoryPropertyFlags preferredProperties) {
 
   VkBufferCreateInfo bufferInfo{};
   bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -514,35 +2051,27 @@ void Vulkan::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
   bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
   bufferInfo.flags = 0;
 
-  VK_CHECK(vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer), "Failed to create buffer");
-
-  auto findMemoryType = [this, properties](uint32_t typeFilter) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
-      if (typeFilter & (1 << i) &&
-        (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-
-        return i;
-      }
-    }
-
-    EXCEPTION("Failed to find suitable memory type");
+  // Concurrent sharing avoids ownership transfers between the compute and transfer families.
+  // Ordering between the queues comes from semaphores.
+  const uint32_t queueFamilies[] = {
+    m_queues[ComputeQueue].family,
+    m_queues[TransferQueue].family
   };
+  if (m_separateTransferQueue && queueFamilies[0] != queueFamilies[1]) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = 2;
+    bufferInfo.pQueueFamilyIndices = queueFamilies;
+  }
+
+  VK_CHECK(vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer), "Failed to create buffer");
 
   VkMemoryRequirements memRequirements;
   vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
 
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits);
+  allocation = m_allocator->allocate(memRequirements, properties, preferredProperties);
 
-  VK_CHECK(vkAllocateMemory(m_device, &allocInfo, nullptr, &bufferMemory),
-    "Failed to allocate memory for buffer");
-
-  vkBindBufferMemory(m_device, buffer, bufferMemory, 0);
+  VK_CHECK(vkBindBufferMemory(m_device, buffer, allocation.memory, allocation.offset),
+    "Failed to bind buffer memory");
 }
 
 void Vulkan::createVulkanInstance() {
@@ -556,7 +2085,7 @@ void Vulkan::createVulkanInstance() {
   appInfo.applicationVersion = VK_MAKE_API_VERSION(1, 0, 0, 0);
   appInfo.pEngineName = "No Engine";
   appInfo.engineVersion = VK_MAKE_API_VERSION(1, 0, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  appInfo.apiVersion = VK_API_VERSION_1_1;
 
   VkInstanceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -581,19 +2110,33 @@ void Vulkan::createVulkanInstance() {
 }
 
 void Vulkan::createCommandPool() {
-  VkCommandPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.queueFamilyIndex = findComputeQueueFamily();
-  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  for (size_t i = 0; i < m_queues.size(); ++i) {
+    if (i == TransferQueue && !m_separateTransferQueue) {
+      continue;
+    }
 
-  VK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool),
-    "Failed to create command pool");
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = m_queues[i].family;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_queues[i].commandPool),
+      "Failed to create command pool");
+  }
 }
 
-VkCommandBuffer Vulkan::createCommandBuffer() {
+VkCommandBuffer Vulkan::createCommandBuffer(size_t queue) {
+  auto& freeCommandBuffers = m_queues[queue].freeCommandBuffers;
+
+  if (!freeCommandBuffers.empty()) {
+    VkCommandBuffer commandBuffer = freeCommandBuffers.back();
+    freeCommandBuffers.pop_back();
+    return commandBuffer;
+  }
+
   VkCommandBufferAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = m_commandPool;
+  allocInfo.commandPool = m_queues[queue].commandPool;
   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
   allocInfo.commandBufferCount = 1;
 
@@ -605,36 +2148,17 @@ VkCommandBuffer Vulkan::createCommandBuffer() {
   return commandBuffer;
 }
 
-std::string loadFile(const std::string& path) {
-  std::ifstream fin(path);
-  std::stringstream ss;
-  std::string line;
-  while (std::getline(fin, line)) {
-    ss << line << std::endl;
-  }
-  return ss.str();
-}
-
-VkShaderModule Vulkan::createShaderModule(const std::string& sourcePath) const {
-  shaderc::Compiler compiler;
-  shaderc::CompileOptions options;
-
-  auto sourcesDirectory = std::filesystem::path(sourcePath).parent_path();
-
-  options.SetIncluder(std::make_unique<SourceIncluder>(sourcesDirectory));
-
-  std::string source = loadFile(sourcePath);
-
-  auto result = compiler.CompileGlslToSpv(source, shaderc_shader_kind::shaderc_glsl_compute_shader,
-    "shader", options);
-
-  if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
-    EXCEPTION("Error compiling shader: " << result.GetErrorMessage());
-  }
+void Vulkan::beginCommandBuffer(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags flags) {
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = flags;
+  beginInfo.pInheritanceInfo = nullptr;
 
-  std::vector<uint32_t> code;
-  code.assign(result.cbegin(), result.cend());
+  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+    "Failed to begin recording command buffer");
+}
 
+VkShaderModule Vulkan::createShaderModule(const std::vector<uint32_t>& code) const {
   VkShaderModuleCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
   createInfo.codeSize = code.size() * sizeof(uint32_t);
@@ -647,16 +2171,31 @@ VkShaderModule Vulkan::createShaderModule(const std::string& sourcePath) const {
   return shaderModule;
 }
 
-VkDescriptorSetLayout Vulkan::createDescriptorSetLayout(const GpuBufferBindings& buffers) {
-  std::vector<VkDescriptorSetLayoutBinding> bindings;
+VkDescriptorType descriptorType(SpirvBufferType type) {
+  return type == SpirvBufferType::uniform ?
+    VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+}
 
-  for (uint32_t slot = 0; slot < buffers.size(); ++slot) {
-    GpuBufferHandle index = buffers[slot];
-    const Buffer& buffer = m_buffers[index];
+VkDescriptorSetLayout Vulkan::descriptorSetLayout(
+  const std::vector<SpirvBufferBinding>& buffers) {
 
+  DescriptorLayoutKey key;
+  for (const SpirvBufferBinding& buffer : buffers) {
+    ASSERT_MSG(buffer.set == 0, "Only descriptor set 0 is supported");
+    key.push_back({ buffer.binding, descriptorType(buffer.type) });
+  }
+
+  auto cached = m_descriptorSetLayouts.find(key);
+  if (cached != m_descriptorSetLayouts.end()) {
+    return cached->second;
+  }
+
+  std::vector<VkDescriptorSetLayoutBinding> bindings;
+
+  for (const auto& entry : key) {
     VkDescriptorSetLayoutBinding binding{};
-    binding.binding = slot;
-    binding.descriptorType = buffer.type;
+    binding.binding = entry.first;
+    binding.descriptorType = entry.second;
     binding.descriptorCount = 1;  // TODO: Support arrays of buffers
     binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
     binding.pImmutableSamplers = nullptr;
@@ -674,54 +2213,68 @@ VkDescriptorSetLayout Vulkan::createDescriptorSetLayout(const GpuBufferBindings&
   VK_CHECK(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &layout),
     "Failed to create descriptor set layout");
 
+  m_descriptorSetLayouts[key] = layout;
+
   return layout;
 }
 
-void Vulkan::createDescriptorPool() {
-  std::array<VkDescriptorPoolSize, 2> poolSizes{};
-  poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  poolSizes[0].descriptorCount = 16; // TODO
-
-  poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSizes[1].descriptorCount = 16; // TODO
+// Bindings are indexed by binding number. Entries for numbers the shader doesn't use are ignored.
+VkDescriptorSet Vulkan::descriptorSet(const Pipeline& pipeline,
+  const GpuBufferBindings& buffers) {
 
-  VkDescriptorPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolInfo.poolSizeCount = poolSizes.size();
-  poolInfo.pPoolSizes = poolSizes.data();
-  poolInfo.maxSets = 4; // TODO
-
-  VK_CHECK(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool),
-    "Failed to create descriptor pool");
-}
-
-VkDescriptorSet Vulkan::createDescriptorSet(const GpuBufferBindings& buffers,
-  VkDescriptorSetLayout layout) {
+  auto cached = m_descriptorSets.find({ pipeline.descriptorSetLayout, buffers });
+  if (cached != m_descriptorSets.end()) {
+    return cached->second;
+  }
 
-  VkDescriptorSetAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = m_descriptorPool;
-  allocInfo.descriptorSetCount = 1;
-  allocInfo.pSetLayouts = &layout;
+  for (const SpirvBufferBinding& binding : pipeline.reflectedBuffers) {
+    ASSERT_MSG(binding.binding < buffers.size(), "Shader " << pipeline.sourcePath
+      << " has no buffer bound to binding " << binding.binding);
+
+    const Buffer& buffer = m_buffers[buffers[binding.binding]];
+
+    ASSERT_MSG(buffer.type == descriptorType(binding.type), "Buffer bound to binding "
+      << binding.binding << " of shader " << pipeline.sourcePath << " is a "
+      << (buffer.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ? "uniform" : "storage")
+      << " buffer, but the shader declares otherwise");
+
+    // E.g. the vec4 layout of utils.glsl would silently skip up to three trailing elements
+    if (binding.arrayStride != 0) {
+      ASSERT_MSG(buffer.boundSize >= binding.arrayOffset &&
+        (buffer.boundSize - binding.arrayOffset) % binding.arrayStride == 0,
+        "Buffer bound to binding " << binding.binding << " of shader " << pipeline.sourcePath
+        << " is " << buffer.boundSize
+        << " bytes, which isn't a whole number of the shader's " << binding.arrayStride
+        << " byte array elements");
+    }
+  }
 
-  VkDescriptorSet descriptorSet;
+  DescriptorCounts counts;
+  for (const SpirvBufferBinding& binding : pipeline.reflectedBuffers) {
+    if (descriptorType(binding.type) == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+      ++counts.uniform;
+    }
+    else {
+      ++counts.storage;
+    }
+  }
 
-  VK_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, &descriptorSet),
-    "Failed to allocate descriptor set");
+  VkDescriptorSet descriptorSet = m_descriptorAllocator->allocate(pipeline.descriptorSetLayout,
+    counts);
 
-  std::vector<VkDescriptorBufferInfo> bufferInfos(buffers.size());
-  std::vector<VkWriteDescriptorSet> descriptorWrites(buffers.size());
+  std::vector<VkDescriptorBufferInfo> bufferInfos(pipeline.reflectedBuffers.size());
+  std::vector<VkWriteDescriptorSet> descriptorWrites(pipeline.reflectedBuffers.size());
 
-  for (size_t slot = 0; slot < buffers.size(); ++slot) {
-    GpuBufferHandle bufIdx = buffers[slot];
-    const Buffer& buffer = m_buffers[bufIdx];
+  for (size_t i = 0; i < pipeline.reflectedBuffers.size(); ++i) {
+    uint32_t slot = pipeline.reflectedBuffers[i].binding;
+    const Buffer& buffer = m_buffers[buffers[slot]];
 
-    auto& bufferInfo = bufferInfos[slot];
+    auto& bufferInfo = bufferInfos[i];
     bufferInfo.buffer = buffer.handle;
     bufferInfo.offset = 0;
-    bufferInfo.range = buffer.size;
+    bufferInfo.range = buffer.boundSize;
 
-    auto& descriptorWrite = descriptorWrites[slot];
+    auto& descriptorWrite = descriptorWrites[i];
     descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     descriptorWrite.dstSet = descriptorSet;
     descriptorWrite.dstBinding = slot;
@@ -735,52 +2288,61 @@ VkDescriptorSet Vulkan::createDescriptorSet(const GpuBufferBindings& buffers,
 
   vkUpdateDescriptorSets(m_device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
 
+  m_descriptorSets[{ pipeline.descriptorSetLayout, buffers }] = descriptorSet;
+
   return descriptorSet;
 }
 
-VkPipelineLayout Vulkan::createPipelineLayout(VkDescriptorSetLayout descriptorSetLayout) {
+void Vulkan::releaseDescriptorSets(GpuBufferHandle buffer) {
+  for (auto i = m_descriptorSets.begin(); i != m_descriptorSets.end();) {
+    const GpuBufferBindings& bindings = i->first.second;
+
+    if (std::find(bindings.begin(), bindings.end(), buffer) != bindings.end()) {
+      m_descriptorAllocator->free(i->second);
+      i = m_descriptorSets.erase(i);
+    }
+    else {
+      ++i;
+    }
+  }
+}
+
+VkPipelineLayout Vulkan::createPipelineLayout(VkDescriptorSetLayout descriptorSetLayout,
+  uint32_t pushConstantsSize) {
+
   VkPipelineLayout pipelineLayout;
 
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = pushConstantsSize;
+
   VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   pipelineLayoutInfo.setLayoutCount = 1;
   pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;  // TODO: Support push constants
-  pipelineLayoutInfo.pPushConstantRanges = nullptr;
+  pipelineLayoutInfo.pushConstantRangeCount = pushConstantsSize > 0 ? 1 : 0;
+  pipelineLayoutInfo.pPushConstantRanges = pushConstantsSize > 0 ? &pushConstantRange : nullptr;
   VK_CHECK(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &pipelineLayout),
     "Failed to create pipeline layout");
 
   return pipelineLayout;
 }
 
-void Vulkan::dispatchWorkgroups(VkCommandBuffer commandBuffer, size_t pipelineIdx,
-  const Size3& numWorkgroups) {
+void Vulkan::dispatchWorkgroups(VkCommandBuffer commandBuffer, ShaderHandle shaderHandle,
+  VkDescriptorSet descriptorSet, const Size3& numWorkgroups, const void* pushConstants) {
 
-  const Pipeline& pipeline = m_pipelines[pipelineIdx];
-
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = 0;
-  beginInfo.pInheritanceInfo = nullptr;
+  const Pipeline& pipeline = m_pipelines[shaderHandle];
 
-  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo),
-    "Failed to begin recording command buffer");
+  if (pipeline.pushConstantsSize > 0) {
+    vkCmdPushConstants(commandBuffer, pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+      pipeline.pushConstantsSize, pushConstants);
+  }
 
   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.handle);
   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1,
-    &pipeline.descriptorSet, 0, 0);
+    &descriptorSet, 0, 0);
   vkCmdDispatch(commandBuffer, numWorkgroups[0], numWorkgroups[1], numWorkgroups[2]);
-
-  VK_CHECK(vkEndCommandBuffer(commandBuffer), "Failed to record command buffer");
-}
-
-void Vulkan::createSyncObjects() {
-  VkFenceCreateInfo fenceInfo{};
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = 0;
-
-  VK_CHECK(vkCreateFence(m_device, &fenceInfo, nullptr, &m_taskCompleteFence),
-    "Failed to create fence");
 }
 
 void Vulkan::destroyDebugMessenger() {
@@ -790,18 +2352,60 @@ void Vulkan::destroyDebugMessenger() {
 }
 
 Vulkan::~Vulkan() {
-  vkDestroyFence(m_device, m_taskCompleteFence, nullptr);
-  vkDestroyCommandPool(m_device, m_commandPool, nullptr);
-  for (const auto& pipeline : m_pipelines) {
+  vkDeviceWaitIdle(m_device);
+  for (auto& submission : m_submissions) {
+    for (auto& release : submission.releases) {
+      release();
+    }
+  }
+  for (auto& release : m_batchReleases) {
+    release();
+  }
+  for (const auto& submission : m_submissions) {
+    for (VkQueryPool pool : submission.queryPools) {
+      vkDestroyQueryPool(m_device, pool, nullptr);
+    }
+    for (VkFence fence : submission.fences) {
+      vkDestroyFence(m_device, fence, nullptr);
+    }
+    for (VkSemaphore semaphore : submission.semaphores) {
+      vkDestroySemaphore(m_device, semaphore, nullptr);
+    }
+  }
+  for (VkFence fence : m_freeFences) {
+    vkDestroyFence(m_device, fence, nullptr);
+  }
+  for (VkSemaphore semaphore : m_freeSemaphores) {
+    vkDestroySemaphore(m_device, semaphore, nullptr);
+  }
+  for (VkQueryPool pool : m_freeQueryPools) {
+    vkDestroyQueryPool(m_device, pool, nullptr);
+  }
+  for (VkQueryPool pool : m_batchQueryPools) {
+    vkDestroyQueryPool(m_device, pool, nullptr);
+  }
+  destroyStagingBuffer();
+  for (const auto& queue : m_queues) {
+    vkDestroyCommandPool(m_device, queue.commandPool, nullptr);
+  }
+  for (VkPipeline pipeline : m_retiredPipelines) {
+    vkDestroyPipeline(m_device, pipeline, nullptr);
+  }
+  m_pipelines.forEach([this](const Pipeline& pipeline) {
     vkDestroyPipeline(m_device, pipeline.handle, nullptr);
     vkDestroyPipelineLayout(m_device, pipeline.layout, nullptr);
-    vkDestroyDescriptorSetLayout(m_device, pipeline.descriptorSetLayout, nullptr);
+  });
+  for (const auto& entry : m_descriptorSetLayouts) {
+    vkDestroyDescriptorSetLayout(m_device, entry.second, nullptr);
   }
-  for (auto& buffer : m_buffers) {
+  m_buffers.forEach([this](const Buffer& buffer) {
     vkDestroyBuffer(m_device, buffer.handle, nullptr);
-    vkFreeMemory(m_device, buffer.memory, nullptr);
-  }
-  vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+    m_allocator->free(buffer.allocation);
+  });
+  m_descriptorAllocator.reset();
+  savePipelineCache();
+  vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
+  m_allocator.reset();
 #ifndef NDEBUG
   destroyDebugMessenger();
 #endif
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "exception.hpp"
+#include <vulkan/vulkan.h>
+
+#define VK_CHECK(fnCall, msg) \
+  { \
+    VkResult code = fnCall; \
+    if (code != VK_SUCCESS) { \
+      EXCEPTION(msg << " (result: " << code << ")"); \
+    } \
+  }
+
+inline VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
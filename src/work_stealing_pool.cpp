@@ -0,0 +1,170 @@
+#include "work_stealing_pool.hpp"
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(size_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  m_threadCount = threadCount;
+  m_ranges.reset(new Range[threadCount]);
+
+  // The calling thread takes index 0
+  for (size_t i = 1; i < threadCount; ++i) {
+    m_threads.emplace_back(&WorkStealingPool::run, this, i);
+  }
+}
+
+size_t WorkStealingPool::threadCount() const {
+  return m_threadCount;
+}
+
+void WorkStealingPool::parallelFor(size_t count, size_t grainSize,
+  const std::function<void(size_t, size_t)>& fn) {
+
+  if (count == 0) {
+    return;
+  }
+
+  std::lock_guard callLock(m_callMutex);
+
+  size_t share = (count + m_threadCount - 1) / m_threadCount;
+  for (size_t i = 0; i < m_threadCount; ++i) {
+    std::lock_guard rangeLock(m_ranges[i].mutex);
+    m_ranges[i].begin = std::min(i * share, count);
+    m_ranges[i].end = std::min(m_ranges[i].begin + share, count);
+  }
+
+  {
+    std::lock_guard lock(m_mutex);
+    m_job = &fn;
+    m_grainSize = std::max<size_t>(grainSize, 1);
+    m_error = nullptr;
+    m_busy = m_threads.size();
+    ++m_generation;
+  }
+
+  m_jobReady.notify_all();
+
+  work(0);
+
+  std::unique_lock lock(m_mutex);
+  m_jobDone.wait(lock, [this]() { return m_busy == 0; });
+
+  m_job = nullptr;
+
+  if (m_error) {
+    std::exception_ptr error = m_error;
+    m_error = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void WorkStealingPool::run(size_t index) {
+  uint64_t generation = 0;
+
+  while (true) {
+    {
+      std::unique_lock lock(m_mutex);
+      m_jobReady.wait(lock, [&]() { return m_stopping || m_generation != generation; });
+
+      if (m_stopping) {
+        return;
+      }
+
+      generation = m_generation;
+    }
+
+    work(index);
+
+    std::lock_guard lock(m_mutex);
+    if (--m_busy == 0) {
+      m_jobDone.notify_one();
+    }
+  }
+}
+
+void WorkStealingPool::work(size_t index) {
+  size_t begin = 0;
+  size_t end = 0;
+
+  while (true) {
+    if (!takeChunk(index, begin, end)) {
+      if (!steal(index)) {
+        return;
+      }
+      continue;
+    }
+
+    try {
+      (*m_job)(begin, end);
+    }
+    catch (...) {
+      std::lock_guard lock(m_mutex);
+      if (!m_error) {
+        m_error = std::current_exception();
+      }
+    }
+  }
+}
+
+bool WorkStealingPool::takeChunk(size_t index, size_t& begin, size_t& end) {
+  Range& range = m_ranges[index];
+  std::lock_guard lock(range.mutex);
+
+  if (range.begin == range.end) {
+    return false;
+  }
+
+  begin = range.begin;
+  end = std::min(range.begin + m_grainSize, range.end);
+  range.begin = end;
+
+  return true;
+}
+
+// Moves half of another thread's remaining range into this thread's, which must be empty
+bool WorkStealingPool::steal(size_t index) {
+  for (size_t offset = 1; offset < m_threadCount; ++offset) {
+    Range& victim = m_ranges[(index + offset) % m_threadCount];
+
+    size_t begin = 0;
+    size_t end = 0;
+
+    {
+      std::lock_guard lock(victim.mutex);
+
+      size_t remaining = victim.end - victim.begin;
+      if (remaining == 0) {
+        continue;
+      }
+
+      // Take the back half, leaving the victim the part it's about to reach
+      begin = victim.begin + remaining / 2;
+      end = victim.end;
+      victim.end = begin;
+    }
+
+    Range& range = m_ranges[index];
+    std::lock_guard lock(range.mutex);
+    range.begin = begin;
+    range.end = end;
+
+    return true;
+  }
+
+  return false;
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_stopping = true;
+  }
+
+  m_jobReady.notify_all();
+
+  for (auto& thread : m_threads) {
+    thread.join();
+  }
+}
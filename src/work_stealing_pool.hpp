@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs data-parallel loops across a fixed set of threads, including the caller. Each thread
+// starts with an equal share of the range and works through it in grain-sized chunks from the
+// front. Threads that run out steal the back half of another thread's remaining share, so uneven
+// chunk costs don't leave threads idle.
+class WorkStealingPool {
+  public:
+    // A threadCount of 0 uses one thread per hardware core
+    explicit WorkStealingPool(size_t threadCount = 0);
+
+    size_t threadCount() const;
+
+    // Calls fn(begin, end) on disjoint chunks of at most grainSize that together cover
+    // [0, count), and blocks until all calls have returned. If any call throws, one of the
+    // exceptions is rethrown. Mustn't be called from within fn.
+    void parallelFor(size_t count, size_t grainSize,
+      const std::function<void(size_t, size_t)>& fn);
+
+    ~WorkStealingPool();
+
+  private:
+    // Padded to a cache line so threads working through adjacent ranges don't contend
+    struct alignas(64) Range {
+      std::mutex mutex;
+      size_t begin = 0;
+      size_t end = 0;
+    };
+
+    void run(size_t index);
+    void work(size_t index);
+    bool takeChunk(size_t index, size_t& begin, size_t& end);
+    bool steal(size_t index);
+
+    size_t m_threadCount = 0;
+    std::unique_ptr<Range[]> m_ranges;
+    std::vector<std::thread> m_threads;
+    std::mutex m_callMutex; // Held for the duration of a parallelFor()
+    std::mutex m_mutex;
+    std::condition_variable m_jobReady;
+    std::condition_variable m_jobDone;
+    const std::function<void(size_t, size_t)>* m_job = nullptr;
+    size_t m_grainSize = 1;
+    uint64_t m_generation = 0; // Incremented for each job
+    size_t m_busy = 0; // Worker threads yet to finish the current job
+    std::exception_ptr m_error;
+    bool m_stopping = false;
+};